@@ -0,0 +1,73 @@
+#!/bin/bash
+
+# Сравнение производительности вариантов сборки исполнителя.
+#
+# Каждый вариант собирается во временном каталоге, после чего исполняются
+# нагрузочные примеры. Выводится время исполнения (лучшее из нескольких).
+#
+#   ./bench.sh              — все варианты;
+#   ./bench.sh wide compact — только перечисленные (и исходный для сравнения).
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=$(mktemp -d)
+trap 'rm -rf "$BUILD"' EXIT
+RUNS=${RUNS:-3}
+export LC_ALL=${LC_ALL:-C.UTF-8}
+
+# Имя варианта и определения для make.
+declare -A variants=(
+   [default]=""
+   [compact]="-DREFAL_CELL_COMPACT=1"
+   [wide]="-DREFAL_INDEX_WIDE=1"
+   [nocompact]="-DREFAL_INTERPRETER_COMPACT_FRAGMENTS=0"
+   [huge]=""
+   [reserve]=""
+   [near]="-DREFAL_FREE_POLICY=1"
+   [noprefetch]="-DREFAL_PREFETCH=0"
+   [soa]="-DREFAL_CELL_SOA=1"
+   [switch]="-DREFAL_INTERPRETER_THREADED=0"
+)
+
+# Ключи исполнителя для варианта.
+declare -A options=(
+   [huge]="+h"
+   [reserve]="+r"
+)
+
+# Нагрузка: имя файла (относительно корня проекта) и ключи исполнителя.
+workloads=(
+   "tests/1000000.ref"
+   "examples/простые.реф"
+   "examples/память.реф"
+   "examples/копирование.реф"
+   "examples/копирование выражений.реф"
+)
+
+selected=(default "$@")
+[ $# -eq 0 ] && selected=(default $(printf '%s\n' "${!variants[@]}" | grep -v '^default$' | sort))
+
+best_time() {
+   local best=
+   for ((r = 0; r < RUNS; ++r)); do
+      local t0=$(date +%s%N)
+      "$@" >/dev/null 2>&1
+      local t=$(( ($(date +%s%N) - t0) / 1000000 ))
+      [ -z "$best" ] || [ "$t" -lt "$best" ] && best=$t
+   done
+   echo "$best"
+}
+
+printf '%-12s' "вариант"
+for w in "${workloads[@]}"; do printf ' %24s' "$(basename "$w")"; done
+echo
+
+for v in "${selected[@]}"; do
+   [ -v "variants[$v]" ] || { echo "неизвестный вариант: $v" >&2; continue; }
+   mkdir -p "$BUILD/$v"
+   make -s -C "$BUILD/$v" -f "$ROOT/Makefile" DEFINES="${variants[$v]}" >/dev/null || continue
+   printf '%-12s' "$v"
+   for w in "${workloads[@]}"; do
+      printf ' %21s мс' "$(cd "$ROOT" && best_time "$BUILD/$v/refal" ${options[$v]} $w)"
+   done
+   echo
+done
@@ -7,6 +7,7 @@
 #include "interpreter.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 
 static inline
@@ -46,6 +47,145 @@ void *realloc_stack(void **mem, unsigned *size, unsigned *max, size_t element)
    return p;
 }
 
+/**
+ * Функция, найденная `Mu` в месте вызова (ячейке rf_execute) по имени,
+ * заданному строкой в начале поля зрения.
+ */
+struct mu_site {
+   rf_index     site;
+   unsigned     len;     ///< Длина имени, 0 — запись пуста.
+   struct rf_id function;
+   wchar_t      name[REFAL_INTERPRETER_MU_NAME];
+};
+
+/**
+ * Сравнивает строку в начале поля зрения с именем, запомненным для места
+ * вызова. При несовпадении запись заполняется этой строкой и ожидает
+ * найденную по ней функцию (иначе остаётся пустой).
+ * \result ячейка, следующая за строкой, при совпадении, либо 0.
+ */
+static inline
+rf_index mu_site_match(
+      const struct refal_vm   *vm,
+      struct mu_site          *mu,
+      rf_index                site,
+      rf_index                prev,
+      rf_index                next)
+{
+   rf_index s = vm->u[prev].next;
+   bool hit = mu->site == site && mu->len && mu->function.tag != rf_id_undefined;
+   unsigned len = 0;
+   for (; s != next && vm->u[s].op == rf_char; s = vm->u[s].next, ++len) {
+      if (len == REFAL_INTERPRETER_MU_NAME) {
+         // Длинное имя не запоминается.
+         *mu = (struct mu_site) { 0 };
+         return 0;
+      }
+      const wchar_t c = RF_VALUE(vm, s).chr;
+      hit = hit && len < mu->len && mu->name[len] == c;
+      mu->name[len] = c;
+   }
+   if (hit && len == mu->len)
+      return s;
+   mu->site = site;
+   mu->len  = len;
+   mu->function = (struct rf_id) { rf_id_undefined };
+   return 0;
+}
+
+/**
+ * Ищет на уровне скобок терм, равный литералу `lit`, начиная с `cur`
+ * и по `stop` включительно (до закрывающей скобки уровня либо `next`).
+ * \result позиция найденного терма либо 0.
+ */
+static inline
+rf_index find_literal(struct refal_vm *vm, rf_index cur, rf_index stop, rf_index next, rf_index lit)
+{
+   for (; cur != next; cur = vm->u[cur].next) {
+      rf_prefetch_next(vm, cur);
+      const rf_index term = cur;
+      switch (vm->u[cur].op) {
+      case rf_closing_bracket:
+         return 0;
+      case rf_opening_bracket:
+         cur = RF_VALUE(vm, cur).link;
+         assert(cur < vm->size);
+         break;
+      default:
+         if (rf_svar_equal(vm, cur, lit))
+            return cur;
+      }
+      if (term == stop)
+         break;
+   }
+   return 0;
+}
+
+/**\details
+   Выбор обработчика опкода.
+
+   При `REFAL_INTERPRETER_THREADED` обработчик выбирается косвенным переходом
+   по таблице адресов меток, и переход к следующему опкоду повторяется в конце
+   каждого обработчика (`PATTERN_NEXT()`, `RESULT_NEXT()`). Так предсказание
+   перехода учитывает предшествующий опкод, чего не обеспечивает единственный
+   переход оператора switch. Оператор при этом сохраняется для сборки
+   другими компиляторами.
+ */
+#if REFAL_INTERPRETER_PROFILE
+/// Количество исполнений опкода (второй индекс) вслед за смежным
+/// предшествующим в программе (первый индекс).
+static unsigned long long op_pairs[1 << 4][1 << 4];
+
+#define OP_PROFILE(tag)          ++op_pairs[vm->u[vm->u[ip].prev].op][tag]
+
+static
+int op_pair_compare(const void *a, const void *b)
+{
+   const unsigned long long x = **(const unsigned long long **)a;
+   const unsigned long long y = **(const unsigned long long **)b;
+   return (x < y) - (x > y);
+}
+
+/**
+ * Выводит частоту пар опкодов в порядке убывания (для выбора составных).
+ */
+static
+void op_pairs_print(FILE *stream)
+{
+   static const char *const name[1 << 4] = {
+      "undefined", "char", "number", "identifier", "(", ")", "name",
+      "sentence", ":", "=", "<", ">", "s", "t", "e", "?",
+   };
+   const unsigned long long *pair[1 << 8];
+   unsigned n = 0;
+   for (unsigned i = 0; i != 1 << 8; ++i) {
+      if (op_pairs[i >> 4][i & 15])
+         pair[n++] = &op_pairs[i >> 4][i & 15];
+   }
+   qsort(pair, n, sizeof(*pair), op_pair_compare);
+   for (unsigned i = 0; i != n; ++i) {
+      const ptrdiff_t k = pair[i] - &op_pairs[0][0];
+      fprintf(stream, "%12llu %s %s\n", *pair[i], name[k >> 4], name[k & 15]);
+   }
+}
+#else
+#define OP_PROFILE(tag)
+#endif
+
+#if REFAL_INTERPRETER_THREADED
+#define OP_GOTO(table, tag)      OP_PROFILE(tag); goto *table[tag]
+#define OP_DISPATCH(table, tag)  OP_GOTO(table, tag); switch (tag)
+#define OP_LABEL(label)          label:
+#else
+#define OP_DISPATCH(table, tag)  OP_PROFILE(tag); switch (tag)
+#define OP_LABEL(label)
+#endif
+
+/// Следующий опкод. Исполняемый код, размещённый `refal_translate_layout()`,
+/// занимает смежные ячейки до `vm->code`, и переход не требует чтения ссылки.
+/// Прочие опкоды (предложения ящиков) связаны списком.
+#define OP_NEXT(i)               ((i) < code ? (i) + 1 : vm->u[i].next)
+
 /**\details
    Формат функции:
 
@@ -66,14 +206,20 @@ void *realloc_stack(void **mem, unsigned *size, unsigned *max, size_t element)
 int refal_run_opcodes(
       struct refal_interpreter_config  *cfg,
       struct refal_vm      *vm,
-      rf_index             prev,
-      rf_index             next,
+      rf_index             *field_prev,
+      rf_index             *field_next,
       rf_index             next_sentence,
       struct refal_message *st)
 {
    refal_message_source(st, "исполнитель");
    int r = 0;
    size_t step = 0;
+   rf_index prev = *field_prev;
+   rf_index next = *field_next;
+   // Порог упорядочивания ячеек.
+   rf_index compact_at = cfg->compact_fragments;
+   // Последняя ячейка исполняемого кода, размещённого подряд (`OP_NEXT()`).
+   const rf_index code = vm->code;
 
    struct {
       rf_index ip;
@@ -89,6 +235,21 @@ int refal_run_opcodes(
    // Исполняемая функция, для определения имени.
    struct rf_id  fn_name = { .link = next_sentence, .tag = rf_id_op_code };
 
+   // Функции, найденные Mu по имени-строке (например, в Apply и Map
+   // библиотеки LibraryEx, вызывающих Mu для каждого элемента).
+   static_assert(!(REFAL_INTERPRETER_MU_CACHE & (REFAL_INTERPRETER_MU_CACHE - 1)),
+                 "Размер кеша Mu — степень 2.");
+   struct mu_site mu_cache[REFAL_INTERPRETER_MU_CACHE] = { 0 };
+
+   // Значения e-переменных, перенесённые в аргумент вызова вместо копий
+   // (`rf_op_var_borrow`), и ячейки, за которыми они располагались.
+   // Возвращаются на место в обратном порядке по завершении вызова.
+   struct {
+      rf_index v;
+      rf_index prev;
+   } borrowed[REFAL_INTERPRETER_BORROWED];
+   unsigned nb = 0;
+
    struct {
       // s-переменная или первый элемент e- или t- переменной.
       rf_index s;
@@ -126,6 +287,7 @@ int refal_run_opcodes(
       rf_index idx;  // откат поля зрения на переменную с данным индексом.
       unsigned bp;   // откат указателя скобок при расширении evar
       rf_index ob;   // предшествующая evar скобка (содержимое стека переписывается!)
+      rf_index stop; // граница расширения (далее термы для остатка образца)
    } evar[evar_max];
 
    // Здесь храним ссылки на предложения-образцы.
@@ -138,8 +300,118 @@ int refal_run_opcodes(
    } pattern[pat_max];
    unsigned pp;
 
+   // Опкоды образца, требующие очередного элемента поля зрения,
+   // и, напротив, требующие его отсутствия (прочие проверяют границу сами).
+   const unsigned pattern_term = ~(1u << rf_evar | 1u << rf_name | 1u << rf_sentence
+                                 | 1u << rf_colon | 1u << rf_equal);
+   const unsigned pattern_end  = 1u << rf_colon | 1u << rf_equal;
+
+#if REFAL_INTERPRETER_THREADED
+   static const void *const pattern_op[1 << 4] = {
+      [0 ... (1 << 4) - 1] = &&pattern_undefined,
+      [rf_char]            = &&pattern_literal,
+      [rf_number]          = &&pattern_literal,
+      [rf_identifier]      = &&pattern_identifier,
+      [rf_opening_bracket] = &&pattern_opening_bracket,
+      [rf_closing_bracket] = &&pattern_closing_bracket,
+      [rf_name]            = &&pattern_sentence,
+      [rf_sentence]        = &&pattern_sentence,
+      [rf_colon]           = &&pattern_colon,
+      [rf_equal]           = &&equal,
+      [rf_open_function]   = &&pattern_execute,
+      [rf_execute]         = &&pattern_execute,
+      [rf_svar]            = &&pattern_svar,
+      [rf_tvar]            = &&pattern_var,
+      [rf_evar]            = &&pattern_var,
+   };
+   static const void *const result_op[1 << 4] = {
+      [0 ... (1 << 4) - 1] = &&result_undefined,
+      [rf_char]            = &&result_literal,
+      [rf_number]          = &&result_literal,
+      [rf_identifier]      = &&result_literal,
+      [rf_opening_bracket] = &&result_opening_bracket,
+      [rf_closing_bracket] = &&result_closing_bracket,
+      [rf_name]            = &&result_return,
+      [rf_sentence]        = &&result_return,
+      [rf_colon]           = &&result_colon,
+      [rf_equal]           = &&result_equal,
+      [rf_open_function]   = &&result_call,
+      [rf_execute]         = &&result_execute,
+      [rf_svar]            = &&result_var,
+      [rf_tvar]            = &&result_var,
+      [rf_evar]            = &&result_var,
+   };
+// Шаг цикла сопоставления с образцом (с проверкой границы поля зрения).
+#define PATTERN_NEXT() { \
+      ip = OP_NEXT(ip); \
+      cur = fetch ? vm->u[cur].next : cur; \
+      rf_prefetch_next(vm, cur); \
+      fetch = true; \
+      tag = vm->u[ip].op; \
+      e_next = 0; \
+      if ((cur == next ? pattern_term : pattern_end) >> tag & 1) \
+         goto sentence; \
+      OP_GOTO(pattern_op, tag); \
+   }
+#define RESULT_NEXT() { \
+      ip  = OP_NEXT(ip); \
+      tag = vm->u[ip].op; \
+      OP_GOTO(result_op, tag); \
+   }
+#else
+#define PATTERN_NEXT()  continue
+#define RESULT_NEXT()   continue
+#endif
+// Переход к литералу, заведомо следующему за командой (`rf_op_literal_next`).
+#define PATTERN_LITERAL() { \
+      ip  = OP_NEXT(ip); \
+      cur = vm->u[cur].next; \
+      if (cur == next) \
+         goto sentence; \
+      goto pattern_literal; \
+   }
+#define RESULT_LITERAL() { \
+      ip  = OP_NEXT(ip); \
+      tag = vm->u[ip].op; \
+      goto result_literal; \
+   }
+
 execute:
    ++step;
+   // Между вызовами функций действительны лишь индексы в стеках вызовов,
+   // переменных и скобок (вызывающих функций) и границы поля зрения.
+   if (compact_at && vm->fragments >= compact_at) {
+      const rf_index size = vm->size;
+      rf_index *map = refal_vm_compact(vm);
+      if (map) {
+         rtrie_relocate(vm->rt, map, size);
+         for (unsigned i = 0; i != sp; ++i) {
+            stack[i].ip     = rf_relocate(map, size, stack[i].ip);
+            stack[i].prev   = rf_relocate(map, size, stack[i].prev);
+            stack[i].next   = rf_relocate(map, size, stack[i].next);
+            stack[i].result = rf_relocate(map, size, stack[i].result);
+         }
+         for (ptrdiff_t i = 0; i != var - var_stack; ++i) {
+            var_stack[i].s    = rf_relocate(map, size, var_stack[i].s);
+            var_stack[i].last = rf_relocate(map, size, var_stack[i].last);
+         }
+         for (unsigned i = 0; i != bp; ++i)
+            bracket[i] = rf_relocate(map, size, bracket[i]);
+         prev = rf_relocate(map, size, prev);
+         next = rf_relocate(map, size, next);
+         next_sentence = rf_relocate(map, size, next_sentence);
+         fn_name = rf_relocate_id(map, size, fn_name);
+         for (unsigned i = 0; i != REFAL_INTERPRETER_MU_CACHE; ++i) {
+            mu_cache[i].site     = rf_relocate(map, size, mu_cache[i].site);
+            mu_cache[i].function = rf_relocate_id(map, size, mu_cache[i].function);
+         }
+         *field_prev = rf_relocate(map, size, *field_prev);
+         *field_next = rf_relocate(map, size, *field_next);
+         refal_free(map, size * sizeof(*map));
+      }
+      // Новый порог соразмерен занятой памяти.
+      compact_at = vm->free > cfg->compact_fragments ? vm->free : cfg->compact_fragments;
+   }
    rf_index ip  = next_sentence;    // текущая инструкция в предложении
    rf_index cur = vm->u[prev].next; // текущий элемент в образце
    rf_index result = 0;    // результат формируется между этой и vm->free.
@@ -165,7 +437,7 @@ sentence: ;
       if (vm->u[ip].op != rf_sentence)
          continue;
       cur = pattern[pp - 1].cur;
-      pattern[pp - 1].next = vm->u[ip].link;
+      pattern[pp - 1].next = RF_VALUE(vm, ip).link;
       ip  = vm->u[ip].next;
       box = true;
       break;
@@ -197,7 +469,7 @@ next_sentence:
          local = evar[ep].idx;
          cur = var[local].last;
          cur = cur ? vm->u[cur].next : var[local].s;
-         if (cur != next)
+         if (cur != evar[ep].stop)
             break;
 prev_evar:
          // Если началась исполняться вложенная безымянная функция, значит
@@ -215,7 +487,7 @@ prev_evar:
       case rf_closing_bracket:
          goto prev_evar;
       case rf_opening_bracket:
-         cur = vm->u[cur].link;
+         cur = RF_VALUE(vm, cur).link;
          // TODO накладно проверять, попадает ли индекс в диапазон до next.
          // Задача транслятора это гарантировать. Для случая, когда опкоды
          // получены из другого источника, проверим на принадлежность массиву.
@@ -229,6 +501,15 @@ prev_evar:
       var[local].last = cur;
       cur = vm->u[cur].next;
       ip = evar[ep].ip;
+      // Далее литерал: расширяем переменную до ближайшего терма, равного ему.
+      if (vm->u[ip].op == rf_char || vm->u[ip].op == rf_number) {
+         rf_index s = find_literal(vm, cur, evar[ep].stop, next, ip);
+         if (!s)
+            goto prev_evar;
+         if (s != cur)
+            var[local].last = vm->u[s].prev;
+         cur = s;
+      }
       bp = evar[ep].bp;
       if (bp) {
          bracket[bp - 1] = evar[ep].ob;
@@ -237,38 +518,37 @@ prev_evar:
    }
 
 anon_function:
-   for (bool fetch; !r ;ip = vm->u[ip].next, cur = fetch ? vm->u[cur].next : cur) {
+   for (bool fetch; !r ;ip = OP_NEXT(ip), cur = fetch ? vm->u[cur].next : cur) {
+      rf_prefetch_next(vm, cur);
       fetch = true;
       tag = vm->u[ip].op;
       rf_index e_next = 0;
 pattern_match:
-      switch (tag) {
-      case rf_colon:
-      case rf_equal: if (cur != next) goto sentence; break;
-      default:       if (cur == next) goto sentence; break;
-      case rf_evar: break;
-      case rf_name: case rf_sentence: if (!pp) break;
-         ip = pattern[--pp].ip;
-         fetch = false;
-         if (pp)
-            continue;
-         // Если за успешно распознанным образцом ящика следует e-переменная,
-         // присваиваем соответствующую часть Поля Зрения.
-         // Если переменная закрыта, проверяем частичное соответствие.
-         ip = vm->u[ip].next;
-         tag = vm->u[ip].op;
-         if (tag != rf_evar)
-            goto pattern_match;
-         e_next = cur;
-         cur    = pattern[pp].cur;
-         break;
-      }
+      if ((cur == next ? pattern_term : pattern_end) >> tag & 1)
+         goto sentence;
 
-      switch (tag) {
-      case rf_undefined: goto error_undefined;
+      OP_DISPATCH(pattern_op, tag) {
+      case rf_undefined: OP_LABEL(pattern_undefined)
+         goto error_undefined;
 
-      case rf_identifier:
-         if (vm->u[ip].id.tag == rf_id_box && !rf_svar_equal(vm, cur, ip)) {
+      case rf_identifier: OP_LABEL(pattern_identifier)
+         if (RF_VALUE(vm, ip).id.tag == rf_id_box && !rf_svar_equal(vm, cur, ip)) {
+            // Варианты ящика — одиночные символы: достаточно проверить
+            // принадлежность множеству. Последующей e-переменной (см. ниже
+            // rf_sentence) присваивается совпавший символ.
+            const struct rf_charset *cs = rf_charset_get(vm, RF_VALUE(vm, ip).id.link);
+            if (cs) {
+               if (!rf_charset_has(vm, cs, cur))
+                  goto sentence;
+               if (!pp && vm->u[vm->u[ip].next].op == rf_evar) {
+                  e_next = vm->u[cur].next;
+                  ip  = vm->u[ip].next;
+                  tag = rf_evar;
+                  fetch = false;
+                  goto pattern_var;
+               }
+               PATTERN_NEXT();
+            }
             if (pp == pat_max) {
                inconsistence(st, "превышен лимит вложенности ящиков в образце", pp, ip);
                r = -2;
@@ -276,19 +556,29 @@ pattern_match:
             }
             pattern[pp].ip  = ip;
             pattern[pp].cur = cur;
-            ip = vm->u[ip].id.link;
+            ip = RF_VALUE(vm, ip).id.link;
             assert(vm->u[ip].op == rf_sentence);
-            pattern[pp++].next = vm->u[ip].link;
+            pattern[pp++].next = RF_VALUE(vm, ip).link;
             fetch = false;
-            continue;
+            PATTERN_NEXT();
          }
          [[fallthrough]];
       case rf_char: case rf_number:
+pattern_literal:
+         // Последовательность символов и чисел сравнивается без диспетчеризации.
+         while (vm->u[ip].mode & rf_op_literal_next) {
+            if (!rf_svar_equal(vm, cur, ip))
+               goto sentence;
+            ip  = vm->u[ip].next;
+            cur = vm->u[cur].next;
+            if (cur == next)
+               goto sentence;
+         }
          if (!rf_svar_equal(vm, cur, ip))
             goto sentence;
-         continue;
+         PATTERN_NEXT();
 
-      case rf_opening_bracket:
+      case rf_opening_bracket: OP_LABEL(pattern_opening_bracket)
          // Данные (link) не совпадают (адресуют разные скобки).
          if (vm->u[cur].op != rf_opening_bracket)
             goto sentence;
@@ -296,22 +586,23 @@ pattern_match:
             !realloc_stack((void**)&bracket, &cfg->brackets_stack_size, &bracket_max, sizeof(*bracket)))
                goto error_bracket_stack_overflow;
          bracket[bp++] = cur;
-         continue;
+         PATTERN_NEXT();
 
-      case rf_closing_bracket:
+      case rf_closing_bracket: OP_LABEL(pattern_closing_bracket)
          // Данные (link) не совпадают (адресуют разные скобки).
          if (vm->u[cur].op != rf_closing_bracket)
             goto sentence;
          if (!bp--)
             goto error_parenthesis_unpaired;
-         continue;
+         PATTERN_NEXT();
 
-      case rf_svar:
+      case rf_svar: OP_LABEL(pattern_svar)
          if (vm->u[cur].op == rf_opening_bracket || vm->u[cur].op == rf_closing_bracket)
             goto sentence;
          [[fallthrough]];
-      case rf_tvar: case rf_evar: ;
-         rf_index v = vm->u[ip].link;
+      case rf_tvar: case rf_evar:
+pattern_var: ;
+         rf_index v = RF_VALUE(vm, ip).link;
          assert(!(v > local));
          // При повторных вхождениях переменной сопоставляем с принятым значеним.
          // e-переменная может быть пуста.
@@ -319,24 +610,71 @@ pattern_match:
             if (tag == rf_svar || (tag == rf_tvar && !var[v].last)) {
                if (!rf_svar_equal(vm, cur, var[v].s))
                   goto sentence;
-               continue;
+               if (vm->u[ip].mode & rf_op_literal_next)
+                  PATTERN_LITERAL();
+               PATTERN_NEXT();
             }
             if (!var[v].last) {
                fetch = false;
-               continue;
+               PATTERN_NEXT();
+            }
+            // Когда известна правая граница сопоставляемого участка (терм
+            // в скобках, e-переменная перед закрывающей скобкой либо в конце
+            // образца), сначала сравниваем последние ячейки: несовпадение
+            // обнаруживается сразу, без просмотра общего начала.
+            rf_index a = var[v].last;
+            rf_index b = 0;
+            if (tag == rf_tvar) {
+               if (vm->u[cur].op != rf_opening_bracket)
+                  goto sentence;
+               // Свёртки вычисляются однократно: при переборе терм
+               // сравнивается многократно.
+               if (rf_bracket_hash_eval(vm, var[v].s) != rf_bracket_hash_eval(vm, cur))
+                  goto sentence;
+               a = vm->u[a].prev;
+               b = RF_VALUE(vm, cur).link;
+            } else if (!e_next) {
+               switch (vm->u[vm->u[ip].next].op) {
+               case rf_closing_bracket:
+                  if (bp)
+                     b = RF_VALUE(vm, bracket[bp - 1]).link;
+                  break;
+               case rf_equal:
+                  b = next;
+                  break;
+               default:
+                  break;
+               }
+            }
+            if (b) {
+               if (!(b < vm->size))
+                  goto error_link_out_of_range;
+               b = vm->u[b].prev;
+               rf_opcode t = vm->u[a].op;
+               if (t != vm->u[b].op)
+                  goto sentence;
+               if (t != rf_opening_bracket && t != rf_closing_bracket
+                && RF_VALUE(vm, a).data != RF_VALUE(vm, b).data)
+                  goto sentence;
             }
             // Размер закрытой переменной равен таковому для первого вхождения.
             for (rf_index s = var[v].s; ; s = vm->u[s].next, cur = vm->u[cur].next) {
+               rf_prefetch_next(vm, s);
+               rf_prefetch_next(vm, cur);
                rf_opcode t = vm->u[s].op;
                if (t != vm->u[cur].op)
                   goto sentence;
-               if (t != rf_opening_bracket && t != rf_closing_bracket
-                && vm->u[s].data != vm->u[cur].data)
+               if (t == rf_opening_bracket) {
+                  const uint32_t h = rf_bracket_hash(vm, s);
+                  if (h && rf_bracket_hash(vm, cur) && h != rf_bracket_hash(vm, cur))
+                     goto sentence;
+               } else if (t != rf_closing_bracket
+                && RF_VALUE(vm, s).data != RF_VALUE(vm, cur).data)
                   goto sentence;
                if (s == var[v].last)
                   break;
             }
-            continue;
+            PATTERN_NEXT();
          }
 
          ++local;
@@ -361,38 +699,42 @@ pattern_match:
          // Первое вхождение - присваиваем переменной текущую позицию в образце.
          var[v].s = cur;
          var[v].last = 0;
+         if (tag == rf_svar && (vm->u[ip].mode & rf_op_literal_next))
+            PATTERN_LITERAL();
          if (tag == rf_svar || (tag == rf_tvar && vm->u[cur].op != rf_opening_bracket))
-            continue;
+            PATTERN_NEXT();
          if (tag == rf_tvar) {
-            cur = vm->u[cur].link;
+            cur = RF_VALUE(vm, cur).link;
             // TODO см. замечание в sentence.
             if (!(cur < vm->size))
                goto error_link_out_of_range;
             var[v].last = cur;
-            continue;
+            PATTERN_NEXT();
          }
          // e-переменная изначально принимает минимальный (0й размер).
          // Если дальнейшая часть образца не совпадает, размер увеличивается.
          // Текущая позицию используется как граница next.
          // Запоминаем индекс переменной для возможного расширения диапазона
          // (если дальше образец расходится).
+         const rf_op_mode tail = vm->u[ip].mode;
          ip  = vm->u[ip].next;
          tag = vm->u[ip].op;
          evar[ep].ip = ip;
          evar[ep].bp = bp;
          evar[ep].ob = bp ? bracket[bp - 1] : 0;
+         evar[ep].stop = next;
          // Устанавливаем правую границу, когда она сразу известна
          // и диапазон не пуст.
          switch (tag) {
          case rf_closing_bracket:
             if (!bp)
                goto error_parenthesis_unpaired;
-            cur = vm->u[bracket[--bp]].link;
+            cur = RF_VALUE(vm, bracket[--bp]).link;
             if (!(cur < vm->size))
                goto error_link_out_of_range;
             if (var[v].s != cur)
                var[v].last = vm->u[cur].prev;
-            continue;
+            PATTERN_NEXT();
          case rf_equal:
             if (cur != next)
                var[v].last = vm->u[next].prev;
@@ -401,30 +743,108 @@ pattern_match:
             if (e_next) {
                var[v].last = vm->u[e_next].prev;
                cur = e_next;
+            } else if (tail & rf_op_evar_tail) {
+               // Остатку образца требуется не менее заданного количества
+               // термов: отсчитываем их от правой границы уровня скобок.
+               // Далее этой позиции переменная не расширяется.
+               rf_index stop = next;
+               if (bp != fn_bp) {
+                  stop = RF_VALUE(vm, bracket[bp - 1]).link;
+                  if (!(stop < vm->size))
+                     goto error_link_out_of_range;
+               }
+               for (unsigned k = tail & rf_op_evar_tail; k; --k) {
+                  if (stop == cur) {
+                     --ep;
+                     goto sentence;
+                  }
+                  stop = vm->u[stop].prev;
+                  if (vm->u[stop].op == rf_closing_bracket)
+                     stop = RF_VALUE(vm, stop).link;
+               }
+               evar[ep].stop = stop;
+               // Если же среди этих термов нет e-переменных, переменная
+               // принимает единственно возможное значение (без расширения).
+               if (tail & rf_op_evar_rigid) {
+                  --ep;
+                  if (stop != cur)
+                     var[v].last = vm->u[stop].prev;
+                  cur = stop;
+                  goto pattern_match;
+               }
+            }
+            // Далее литерал: переменная сразу принимает значение до ближайшего
+            // равного ему терма (если такового нет, расширять её бесполезно).
+            if (!e_next && (tag == rf_char || tag == rf_number)) {
+               rf_index s = find_literal(vm, cur, evar[ep].stop, next, ip);
+               if (!s) {
+                  --ep;
+                  goto sentence;
+               }
+               if (s != cur)
+                  var[v].last = vm->u[s].prev;
+               cur = s;
             }
             goto pattern_match;
          }
 
-      // Начало предложения. Далее следует выражение-образец (возможно, пустое).
-      case rf_sentence:
-         assert(!pp);
-         next_sentence = vm->u[ip].data;
+      // Завершение образца ящика либо начало предложения.
+      case rf_name: case rf_sentence: OP_LABEL(pattern_sentence)
+         if (pp) {
+            ip = pattern[--pp].ip;
+            fetch = false;
+            if (pp)
+               PATTERN_NEXT();
+            // Если за успешно распознанным образцом ящика следует e-переменная,
+            // присваиваем соответствующую часть Поля Зрения.
+            // Если переменная закрыта, проверяем частичное соответствие.
+            ip = vm->u[ip].next;
+            tag = vm->u[ip].op;
+            if (tag != rf_evar) {
+               // Текущая ячейка ещё не сопоставлена: переход минует
+               // PATTERN_NEXT(), сбрасывающий признак.
+               fetch = true;
+               goto pattern_match;
+            }
+            e_next = cur;
+            cur    = pattern[pp].cur;
+            goto pattern_var;
+         }
+         if (tag == rf_name)
+            goto recognition_impossible;
+         // Серия предложений, образцы которых начинаются литералом:
+         // выбираем первое с литералом, равным первому элементу поля зрения.
+         if (vm->u[ip].mode & rf_op_sentence_index) {
+            const struct rf_dispatch *d = rf_dispatch_slot(vm, ip, vm->u[cur].op, RF_VALUE(vm, cur).data);
+            if (cur == next || !d->run)
+               d = rf_dispatch_slot(vm, ip, rf_undefined, 0);
+            ip = d->sentence;
+            if (vm->u[ip].op == rf_name)
+               goto recognition_impossible;
+         }
+         // Далее следует выражение-образец (возможно, пустое).
+         next_sentence = RF_VALUE(vm, ip).data;
+         if (vm->u[ip].mode & rf_op_sentence_empty) {
+            ip = vm->u[ip].next;
+            if (cur != next)
+               goto sentence;
+            goto equal;
+         }
          fetch = false;
-         continue;
+         PATTERN_NEXT();
 
       // Пересматриваем ПЗ для следующего образца.
-      case rf_colon:
+      case rf_colon: OP_LABEL(pattern_colon)
          if (fn_bp != bp)
             goto error_parenthesis_unpaired;
          cur = prev;
-         continue;
+         PATTERN_NEXT();
 
-      case rf_open_function: case rf_execute:
+      case rf_open_function: case rf_execute: OP_LABEL(pattern_execute)
          inconsistence(st, "вычислительная скобка в образце", ip, step);
          r = -2;
          break;
 
-      case rf_name:
 recognition_impossible:
          // TODO Раскрутка стека с размещением в поле зрения признака исключения?
          // Делаем результатом что-то похожее на вызов функции с текущим Полем Зрения.
@@ -449,6 +869,10 @@ equal:   if (fn_bp != bp)
          result = vm->free;
          // Для `rf_insert_next()` отделяем свободное пространство от поля зрения.
          rf_alloc_value(vm, 0, rf_undefined);
+         if (vm->u[ip].mode & rf_op_call_next) {
+            ip = vm->u[ip].next;
+            goto result_call;
+         }
          break;
       }
       break;
@@ -457,76 +881,104 @@ equal:   if (fn_bp != bp)
 
    // Результат
    while (!r) {
-      ip  = vm->u[ip].next;
-      rf_opcode tag = vm->u[ip].op;
+      ip  = OP_NEXT(ip);
+      tag = vm->u[ip].op;
 
-      switch (tag) {
-      case rf_undefined: goto error_undefined;
+      OP_DISPATCH(result_op, tag) {
+      case rf_undefined: OP_LABEL(result_undefined)
+         goto error_undefined;
 
       case rf_char: case rf_number: case rf_identifier:
-         rf_alloc_value(vm, vm->u[ip].data, tag);
-         continue;
+result_literal:
+         // Последовательность символов и чисел размещается без диспетчеризации.
+         // Если далее свободной ячейки начинается не инициализированная часть
+         // массива, ячейки программы (размещённые подряд) копируются блоком.
+         if (vm->u[ip].mode & rf_op_literal_next
+          && vm->u[vm->free].next == vm->free + 1 && !vm->u[vm->free + 1].next) {
+            rf_index last = vm->u[ip].next;
+            while (vm->u[last].mode & rf_op_literal_next)
+               last = vm->u[last].next;
+            rf_alloc_evar_copy(vm, ip, last);
+            ip = last;
+            RESULT_NEXT();
+         }
+         while (vm->u[ip].mode & rf_op_literal_next) {
+            rf_alloc_value(vm, RF_VALUE(vm, ip).data, vm->u[ip].op);
+            ip = vm->u[ip].next;
+         }
+         rf_alloc_value(vm, RF_VALUE(vm, ip).data, vm->u[ip].op);
+         RESULT_NEXT();
 
-      case rf_opening_bracket:
+      case rf_opening_bracket: OP_LABEL(result_opening_bracket)
          if (bp == bracket_max &&
             !realloc_stack((void**)&bracket, &cfg->brackets_stack_size, &bracket_max, sizeof(*bracket)))
                goto error_bracket_stack_overflow;
          bracket[bp++] = rf_alloc_command(vm, rf_opening_bracket);
-         continue;
+         RESULT_NEXT();
 
-      case rf_closing_bracket:
+      case rf_closing_bracket: OP_LABEL(result_closing_bracket)
          if (!bp)
             goto error_parenthesis_unpaired;
          rf_link_brackets(vm, bracket[--bp], rf_alloc_command(vm, rf_closing_bracket));
-         continue;
+         RESULT_NEXT();
 
-      case rf_svar: case rf_tvar: case rf_evar: ;
-         rf_index v = vm->u[ip].link;
+      case rf_svar: case rf_tvar: case rf_evar: OP_LABEL(result_var) ;
+         rf_index v = RF_VALUE(vm, ip).link;
          if (v > local) {
             inconsistence(st, "переменная не определена", ip, step);
             r = -2;
             break;
          }
          if (tag == rf_evar && !var[v].last)
-            continue;
+            RESULT_NEXT();
          if (tag == rf_svar || (tag == rf_tvar && vm->u[var[v].s].op != rf_opening_bracket)) {
             //TODO снижает ли это фрагментацию?
-            rf_alloc_value(vm, vm->u[var[v].s].data, vm->u[var[v].s].op);
-            continue;
+            rf_alloc_value(vm, RF_VALUE(vm, var[v].s).data, vm->u[var[v].s].op);
+            if (vm->u[ip].mode & rf_op_literal_next)
+               RESULT_LITERAL();
+            RESULT_NEXT();
          }
          // Копируем все вхождения кроме последнего (которое переносим).
-         if (vm->u[ip].mode == rf_op_default && (rf_op_var_copy)) {
+         if (!(vm->u[ip].mode & rf_op_var_copy)) {
             rf_alloc_evar_move(vm, vm->u[var[v].s].prev, vm->u[var[v].last].next);
-            continue;
+            RESULT_NEXT();
          }
-         for (rf_index s = var[v].s; ; s = vm->u[s].next) {
-            switch (vm->u[s].op) {
-            case rf_opening_bracket:
-               if (bp == bracket_max &&
-                  !realloc_stack((void**)&bracket, &cfg->brackets_stack_size, &bracket_max, sizeof(*bracket)))
-                     goto error_bracket_stack_overflow;
-               bracket[bp++] = rf_alloc_command(vm, rf_opening_bracket);
-               break;
-            case rf_closing_bracket:
-               // Непарная скобка должна быть определена при сопоставлении.
-               assert(bp);
-               rf_link_brackets(vm, bracket[--bp], rf_alloc_command(vm, rf_closing_bracket));
-               break;
-            default:
-               rf_alloc_value(vm, vm->u[s].data, vm->u[s].op);
-            }
-            if (s == var[v].last)
-               break;
+         // Аргумент функции, лишь читающей его, получает само значение,
+         // возвращаемое на место по завершении вызова (`rf_op_exec_borrow`).
+         if (vm->u[ip].mode & rf_op_var_borrow && nb != REFAL_INTERPRETER_BORROWED) {
+            borrowed[nb].v = v;
+            borrowed[nb++].prev = vm->u[var[v].s].prev;
+            rf_alloc_evar_move(vm, vm->u[var[v].s].prev, vm->u[var[v].last].next);
+            RESULT_NEXT();
          }
-         continue;
+         rf_alloc_evar_copy(vm, var[v].s, var[v].last);
+         RESULT_NEXT();
 
-      case rf_equal:
+      case rf_equal: OP_LABEL(result_equal)
          inconsistence(st, "повторное присваивание", ip, step);
          r = -2;
          break;
 
       // Открыты вычислительные скобки.
       case rf_open_function:
+result_call:
+         // Арифметика над числами вычисляется на месте, без вызова.
+         if (vm->u[ip].mode & rf_op_call_arith) {
+            rf_index s1 = vm->u[ip].next;
+            rf_index s2 = vm->u[s1].next;
+            const rf_index e = vm->u[s2].next;
+            if (vm->u[s1].op == rf_svar && !(RF_VALUE(vm, s1).link > local))
+               s1 = var[RF_VALUE(vm, s1).link].s;
+            if (vm->u[s2].op == rf_svar && !(RF_VALUE(vm, s2).link > local))
+               s2 = var[RF_VALUE(vm, s2).link].s;
+            // Не размещённый результат оставляет вызов библиотеке.
+            if (vm->u[s1].op == rf_number && vm->u[s2].op == rf_number
+                  && rf_alloc_arith(vm, vm->u[ip].mode & rf_op_call_arith,
+                                    rf_num(vm, s1), rf_num(vm, s2))) {
+               ip = e;
+               RESULT_NEXT();
+            }
+         }
          if (!(sp < stack_size) &&
             (cfg->call_stack_size * 2 > cfg->call_stack_max
              || !realloc_stack((void**)&stack, &cfg->call_stack_size, &stack_size, sizeof(*stack)))) {
@@ -539,12 +991,12 @@ equal:   if (fn_bp != bp)
          stack[sp].result = result;
          ++sp;
          prev = vm->u[vm->free].prev;
-         continue;
+         RESULT_NEXT();
 
       // Закрывающая вычислительная скобка приводит к исполнению функции.
-      case rf_execute:
+      case rf_execute: OP_LABEL(result_execute)
          next = vm->free;
-         struct rf_id function = vm->u[ip].id;
+         struct rf_id function = RF_VALUE(vm, ip).id;
          fn_name = function;
          switch (function.tag) {
          case rf_id_module: assert(0);
@@ -560,7 +1012,20 @@ equal:   if (fn_bp != bp)
             // либо её имя в глобальном пространстве и вызываем, удаляя из ПЗ.
             // Если очередной функцией является Mu, "исполняем", продолжая поиск.
             if (!function.link) {
-Mu:            function = rtrie_find_value_by_tags(vm->rt, rf_id_op_code, rf_id_mach_code, vm, prev, next);
+Mu: ;          // Строка, совпадающая с найденной ранее в этом месте вызова,
+               // не требует поиска по таблице символов.
+               struct mu_site *mu = &mu_cache[ip & (REFAL_INTERPRETER_MU_CACHE - 1)];
+               const rf_index end = mu_site_match(vm, mu, ip, prev, next);
+               if (end) {
+                  rf_free_evar(vm, prev, end);
+                  function = mu->function;
+               } else {
+                  const rf_index first = vm->u[prev].next;
+                  function = rtrie_find_value_by_tags(vm->rt, rf_id_op_code, rf_id_mach_code, vm, prev, next);
+                  // Имя найдено строкой в начале поля зрения.
+                  if (function.tag != rf_id_undefined && mu->len && vm->u[prev].next != first)
+                     mu->function = function;
+               }
                if (function.tag == rf_id_undefined) {
                   if (function.link == -1)  goto error_link_out_of_range;
                   else if (!function.link)  goto recognition_impossible;
@@ -584,7 +1049,26 @@ Mu:            function = rtrie_find_value_by_tags(vm->rt, rf_id_op_code, rf_id_
             // и prev ячеек, где количество значащих разрядов ограничено
             // из-за наличия тега. При имеющейся реализации приведение к int
             // должно всегда попадать в диапазон положительных значений.
-            r = vm->library[function.link].function(vm, prev, next);
+            if (vm->u[ip].mode & rf_op_exec_borrow) {
+               r = rf_reader_function(vm->library[function.link].function)(vm, prev, next);
+               // Если отождествление невозможно, исполнение завершается, и
+               // значения остаются в аргументе для сообщения.
+               if (r > 0)
+                  nb = 0;
+               while (nb) {
+                  --nb;
+                  const rf_index s = var[borrowed[nb].v].s;
+                  const rf_index last = var[borrowed[nb].v].last;
+                  rf_splice_evar_prev(vm, vm->u[s].prev, vm->u[last].next,
+                                      vm->u[borrowed[nb].prev].next);
+               }
+               if (!r)
+                  rf_free_evar(vm, prev, next);
+               else
+                  next = vm->free;
+            } else {
+               r = vm->library[function.link].function(vm, prev, next);
+            }
             if (r > 0) {
                cur = r;
                goto recognition_impossible;
@@ -597,10 +1081,10 @@ Mu:            function = rtrie_find_value_by_tags(vm->rt, rf_id_op_code, rf_id_
             result = stack[sp].result;
             next   = stack[sp].next;
             prev   = stack[sp].prev;
-            continue;
+            RESULT_NEXT();
          case rf_id_op_code:
 execute_byte_code:
-            if (vm->u[ip].mode != rf_op_default && (rf_op_exec_tailcall)) {
+            if (vm->u[ip].mode & rf_op_exec_tailcall) {
                assert(sp);
                --sp;
                next = stack[sp].next;
@@ -618,7 +1102,7 @@ execute_byte_code:
             goto execute;
          }
 
-      case rf_colon:
+      case rf_colon: OP_LABEL(result_colon)
          evar_lock = local;
          // Переносим результат в ПЗ, что бы очистить при завершении предложения.
          cur = vm->u[result].next;
@@ -628,7 +1112,7 @@ execute_byte_code:
          next_sentence = 0;
          goto anon_function;
 
-      case rf_name: case rf_sentence:
+      case rf_name: case rf_sentence: OP_LABEL(result_return)
          rf_free_evar(vm, prev, next);
          assert(result);
          rf_splice_evar_prev(vm, result, vm->free, next);
@@ -642,12 +1126,19 @@ return_with_empty:
          next   = stack[sp].next;
          result = stack[sp].result;
          var -= local;
-         continue;
+         RESULT_NEXT();
       }
       break;
    }
+#undef PATTERN_NEXT
+#undef PATTERN_LITERAL
+#undef RESULT_NEXT
+#undef RESULT_LITERAL
 
 cleanup:
+#if REFAL_INTERPRETER_PROFILE
+   op_pairs_print(stderr);
+#endif
    refal_free(bracket, cfg->brackets_stack_size);
    refal_free(var_stack, cfg->var_stack_size);
    refal_free(stack, cfg->call_stack_size);
@@ -13,6 +13,42 @@
 #define REFAL_INTERPRETER_BOXED_PATTERNS     64
 #endif
 
+#ifndef REFAL_INTERPRETER_COMPACT_FRAGMENTS
+#define REFAL_INTERPRETER_COMPACT_FRAGMENTS  (64*1024)
+#endif
+
+/// Количество мест вызова `Mu`, для которых запоминается функция, найденная
+/// по имени-строке (степень 2).
+#ifndef REFAL_INTERPRETER_MU_CACHE
+#define REFAL_INTERPRETER_MU_CACHE           64
+#endif
+
+/// Наибольшая длина имени-строки (в символах), запоминаемого для `Mu`.
+#ifndef REFAL_INTERPRETER_MU_NAME
+#define REFAL_INTERPRETER_MU_NAME            16
+#endif
+
+/// Наибольшее количество e-переменных, заимствуемых вызовом функции вместо
+/// копирования (см. `rf_reader_function()`), прочие копируются.
+#ifndef REFAL_INTERPRETER_BORROWED
+#define REFAL_INTERPRETER_BORROWED           8
+#endif
+
+/// Переход к обработчикам опкодов по таблице адресов меток (расширение GCC
+/// и Clang) вместо оператора switch.
+#ifndef REFAL_INTERPRETER_THREADED
+#if defined(__GNUC__)
+#define REFAL_INTERPRETER_THREADED           1
+#else
+#define REFAL_INTERPRETER_THREADED           0
+#endif
+#endif
+
+/// Подсчёт пар исполняемых подряд опкодов (выводится по завершении).
+#ifndef REFAL_INTERPRETER_PROFILE
+#define REFAL_INTERPRETER_PROFILE            0
+#endif
+
 /**
  * Конфигурация исполнителя.
  * Размеры изменяемых стеков - в байтах, должны быть кратны размеру страницы.
@@ -32,11 +68,18 @@ struct refal_interpreter_config {
 
    /// Допустимое количество переменных в предложении (определяется транслятором).
    unsigned locals;
+
+   /// Количество освобождённых фрагментов памяти, по достижении которого
+   /// ячейки упорядочиваются (`refal_vm_compact()`) перед вызовом очередной
+   /// функции. Порог растёт вместе с объёмом занятой памяти, так что затраты
+   /// на перенос ячеек соразмерны освобождениям. 0 — не упорядочивать.
+   rf_index compact_fragments;
 };
 
 /**
  * Исполнение опкодов РЕФАЛ-машины.
- * Поле зрения располагается _между_ prev и next.
+ * Поле зрения располагается _между_ prev и next. Если в процессе исполнения
+ * ячейки упорядочиваются, границы корректируются.
  * \result
  *         - Отрицательное значение при ошибке исполнения.
  *         - 0 — Успех (Поле Зрения может быть не пусто).
@@ -45,8 +88,8 @@ struct refal_interpreter_config {
 int refal_run_opcodes(
       struct refal_interpreter_config  *cfg, ///< Конфигурация исполнителя.
       struct refal_vm      *vm,        ///< Память Рефал-машины.
-      rf_index             prev,       ///< Левая граница поля зрения.
-      rf_index             next,       ///< Правая граница поля зрения.
+      rf_index             *prev,      ///< Левая граница поля зрения.
+      rf_index             *next,      ///< Правая граница поля зрения.
       rf_index             sentence,   ///< Начальная инструкция.
       struct refal_message *st
       );
@@ -71,20 +71,26 @@ rf_index rf_alloc_input(struct refal_vm *vm, FILE *stream)
    rf_index i = vm->free;
    if (!stream)
       goto eof;
+   // Октеты накапливаются в буфере и размещаются блоками.
+   char buf[256];
+   size_t size = 0;
    unsigned state = 0;
    while (1) {
       int c = fgetc(stream);
-      if (c == '\n') {
-         break;
-      } else if (c == EOF) {
+      if (c == '\n' || c == EOF) {
+         rf_alloc_utf8(vm, buf, size, &state);
          // Признак конца файла не включается в строку,
          // возвращается по отдельному запросу.
-         if (i == vm->free) {
+         if (c == EOF && i == vm->free) {
 eof:        rf_alloc_int(vm, 0);
          }
          break;
       }
-      rf_alloc_char_decode_utf8(vm, (unsigned char)c, &state);
+      buf[size++] = c;
+      if (size == sizeof(buf)) {
+         rf_alloc_utf8(vm, buf, size, &state);
+         size = 0;
+      }
    }
    return i;
 }
@@ -116,6 +122,7 @@ int rf_output(
    assert(stream);
    enum rf_opcode prevt = rf_undefined;
    for (rf_index i = prev; (i = vm->u[i].next) != next; ) {
+      rf_prefetch_next(vm, i);
       switch (vm->u[i].op) {
       case rf_char: {
             char utf8[5];
@@ -124,17 +131,17 @@ int rf_output(
             break;
          }
       case rf_number:
-         fprintf(stream, prevt == rf_number ? " %li" : "%li", vm->u[i].num);
+         fprintf(stream, prevt == rf_number ? " %li" : "%li", (long)rf_num(vm, i));
          break;
       case rf_identifier: ;
-         struct rf_id id = vm->u[i].id;
+         struct rf_id id = RF_VALUE(vm, i).id;
          if (id.tag == rf_id_op_code || id.tag == rf_id_box || id.tag == rf_id_reference) {
             rf_index bytecode = vm->u[id.link].prev;
             if (vm->u[bytecode].op == rf_name) {
                fprintf(stream, prevt == rf_identifier
                        ? RF_COLOR_SYMBOL" %ls"RF_ESC_RESET
                        : RF_COLOR_SYMBOL"%ls"RF_ESC_RESET,
-                       &vm->id.s[vm->u[bytecode].name]);
+                       &vm->id.s[RF_VALUE(vm, bytecode).name]);
                break;
             }
          } else if (id.tag == rf_id_mach_code
@@ -148,7 +155,7 @@ int rf_output(
          fprintf(stream, prevt == rf_identifier
                  ? RF_COLOR_SYMBOL" #%x"RF_ESC_RESET
                  : RF_COLOR_SYMBOL"#%x"RF_ESC_RESET,
-                 vm->u[i].link);
+                 (unsigned)RF_VALUE(vm, i).link);
          break;
       case rf_opening_bracket:
          fprintf(stream, RF_COLOR_BRACKET"("RF_ESC_RESET);
@@ -165,7 +172,7 @@ int rf_output(
       case rf_undefined:
       default:
          // TODO ситуация возникать не должна.
-         fprintf(stderr, "[%u]: rf_undefined\n", i);
+         fprintf(stderr, "[%lu]: rf_undefined\n", (unsigned long)i);
          assert(i);
          return i;
       }
@@ -184,6 +191,11 @@ int Print(const struct refal_vm *vm, rf_index prev, rf_index next)
     return r;
 }
 
+int rf_prout_reader(struct refal_vm *vm, rf_index prev, rf_index next)
+{
+    return Print(vm, prev, next);
+}
+
 int Prout(struct refal_vm *vm, rf_index prev, rf_index next)
 {
     int r = Print(vm, prev, next);
@@ -194,19 +206,19 @@ int Prout(struct refal_vm *vm, rf_index prev, rf_index next)
 static
 FILE *file[REFAL_LIBRARY_LEGACY_FILES];
 
-int Open(struct refal_vm *vm, rf_index prev, rf_index next)
+int rf_open_reader(struct refal_vm *vm, rf_index prev, rf_index next)
 {
    rf_index s = vm->u[prev].next;
    if (s == next || vm->u[s].op != rf_char)
       return s;
-   wchar_t m = vm->u[s].chr;
+   wchar_t m = RF_VALUE(vm, s).chr;
    if (!(m == 'r' || m == 'w' || m == 'a'))
       return s;
 
    s = vm->u[s].next;
    if (s == next || vm->u[s].op != rf_number)
       return s;
-   rf_int fno = vm->u[s].num;
+   rf_int fno = rf_num(vm, s);
    if (!(fno > 0 && fno < REFAL_LIBRARY_LEGACY_FILES))
       return s;
 
@@ -230,18 +242,24 @@ int Open(struct refal_vm *vm, rf_index prev, rf_index next)
 
    char mode[2] = { (char)m, '\0' };
    file[fno] = fopen(path, mode);
-
-   rf_free_evar(vm, prev, next);
    return 0;
 }
 
+int Open(struct refal_vm *vm, rf_index prev, rf_index next)
+{
+   int r = rf_open_reader(vm, prev, next);
+   if (!r)
+      rf_free_evar(vm, prev, next);
+   return r;
+}
+
 int Close(struct refal_vm *vm, rf_index prev, rf_index next)
 {
    rf_index s = vm->u[prev].next;
    if (s == next || vm->u[s].op != rf_number || vm->u[s].next != next)
       return s;
 
-   rf_int fno = vm->u[s].num;
+   rf_int fno = rf_num(vm, s);
    if (!(fno > 0 && fno < REFAL_LIBRARY_LEGACY_FILES))
       return s;
 
@@ -259,7 +277,7 @@ int Get(struct refal_vm *vm, rf_index prev, rf_index next)
    if (s == next || vm->u[s].op != rf_number || vm->u[s].next != next)
       return s;
 
-   rf_int fno = vm->u[s].num;
+   rf_int fno = rf_num(vm, s);
    if (!(fno >= 0 && fno < REFAL_LIBRARY_LEGACY_FILES))
       return s;
 
@@ -268,35 +286,41 @@ int Get(struct refal_vm *vm, rf_index prev, rf_index next)
    return 0;
 }
 
-int Put(struct refal_vm *vm, rf_index prev, rf_index next)
+int rf_putout_reader(struct refal_vm *vm, rf_index prev, rf_index next)
 {
    rf_index s = vm->u[prev].next;
    if (s == next || vm->u[s].op != rf_number)
       return s;
 
-   rf_int fno = vm->u[s].num;
+   rf_int fno = rf_num(vm, s);
    if (!(fno >= 0 && fno < REFAL_LIBRARY_LEGACY_FILES))
       return s;
 
    FILE *f = fno ? file[fno] : stdout;
    int r = rf_output(vm, s, next, f);
-   rf_free_evar(vm, prev, vm->u[s].next);
    fputc('\n', f); // в оригинале выводит и при пустом подвыражении.
    return r;
 }
 
-int Putout(struct refal_vm *vm, rf_index prev, rf_index next)
+int Put(struct refal_vm *vm, rf_index prev, rf_index next)
 {
-   int r = Put(vm, prev, next);
-   rf_free_evar(vm, prev, next);
+   int r = rf_putout_reader(vm, prev, next);
+   if (!r)
+      rf_free_evar(vm, prev, vm->u[vm->u[prev].next].next);
    return r;
 }
 
+int Putout(struct refal_vm *vm, rf_index prev, rf_index next)
+{
+   int r = rf_putout_reader(vm, prev, next);
+   if (!r)
+      rf_free_evar(vm, prev, next);
+   return r;
+}
 
-typedef rf_int aop(rf_int s1, rf_int s2);
 
 static inline
-int calc(struct refal_vm *vm, rf_index prev, rf_index next, aop *op)
+int calc(struct refal_vm *vm, rf_index prev, rf_index next, rf_arith op)
 {
    rf_index s1 = vm->u[prev].next;
    if (s1 == next)
@@ -308,44 +332,37 @@ int calc(struct refal_vm *vm, rf_index prev, rf_index next, aop *op)
       return s1;
    if (vm->u[s2].op != rf_number)
       return s2;
-   vm->u[s1].num = op(vm->u[s1].num, vm->u[s2].num);
+   // Результат, который невозможно разместить (см. `rf_num_data()`),
+   // делает отождествление невозможным.
+   if (!rf_num_data(vm, rf_arith_eval(op, rf_num(vm, s1), rf_num(vm, s2)), &RF_VALUE(vm, s1).data))
+      return s1;
    rf_free_evar(vm, s1, next);
    return 0;
 }
 
-static inline rf_int plus(rf_int s1, rf_int s2) { return s1 + s2; }
-
 int Add(struct refal_vm *vm, rf_index prev, rf_index next)
 {
-   return calc(vm, prev, next, plus);
+   return calc(vm, prev, next, rf_arith_add);
 }
 
-static inline rf_int minus(rf_int s1, rf_int s2) { return s1 - s2; }
-
 int Sub(struct refal_vm *vm, rf_index prev, rf_index next)
 {
-   return calc(vm, prev, next, minus);
+   return calc(vm, prev, next, rf_arith_sub);
 }
 
-static inline rf_int multiplies(rf_int s1, rf_int s2) { return s1 * s2; }
-
 int Mul(struct refal_vm *vm, rf_index prev, rf_index next)
 {
-   return calc(vm, prev, next, multiplies);
+   return calc(vm, prev, next, rf_arith_mul);
 }
 
-static inline rf_int divides(rf_int s1, rf_int s2) { return s2 ? s1/s2 : s2; }
-
 int Div(struct refal_vm *vm, rf_index prev, rf_index next)
 {
-   return calc(vm, prev, next, divides);
+   return calc(vm, prev, next, rf_arith_div);
 }
 
-static inline rf_int modulus(rf_int s1, rf_int s2) { return s2 ? s1%s2 : s2; }
-
 int Mod(struct refal_vm *vm, rf_index prev, rf_index next)
 {
-   return calc(vm, prev, next, modulus);
+   return calc(vm, prev, next, rf_arith_mod);
 }
 
 int Compare(struct refal_vm *vm, rf_index prev, rf_index next)
@@ -356,13 +373,15 @@ int Compare(struct refal_vm *vm, rf_index prev, rf_index next)
    rf_index s2 = vm->u[s1].next;
    if (vm->u[s2].next != next)
       return s2;
+   const rf_int n1 = rf_num(vm, s1);
+   const rf_int n2 = rf_num(vm, s2);
    vm->u[s1].op = rf_char;
-   if (vm->u[s1].num < vm->u[s2].num) {
-      vm->u[s1].data = '-';
-   } else if (vm->u[s1].num > vm->u[s2].num) {
-      vm->u[s1].data = '+';
+   if (n1 < n2) {
+      RF_VALUE(vm, s1).data = '-';
+   } else if (n1 > n2) {
+      RF_VALUE(vm, s1).data = '+';
    } else {
-      vm->u[s1].data = '0';
+      RF_VALUE(vm, s1).data = '0';
    }
    rf_free_evar(vm, s1, next);
    return 0;
@@ -377,16 +396,17 @@ int Push(struct refal_vm *vm, rf_index prev, rf_index next)
       if (vm->u[id.link].op != rf_sentence)
          return prev;
       //TODO ссылку хорошо бы проверять на выход за пределы, но сейчас опкоды создаём сами.
-      rf_index s_next = vm->u[id.link].link;
+      rf_index s_next = RF_VALUE(vm, id.link).link;
       // было:  [rf_name][rf_sentence][...][s_next]
       //                       --------------->
       // стало: [rf_name][rf_sentence] +++ [e-var][s_new] +++ [...][s_next]
       //                       -------------------->  --------------->
       rf_index guard = rf_alloc_value(vm, 0, rf_undefined);
-      vm->u[id.link].data = rf_alloc_value(vm, s_next, rf_sentence);
+      RF_VALUE(vm, id.link).data = rf_alloc_value(vm, s_next, rf_sentence);
       rf_splice_evar_prev(vm, guard, vm->free, vm->u[id.link].next);
       rf_free_last(vm);
       rf_splice_evar_prev(vm, prev, next, vm->u[id.link].next);
+      rf_charset_invalidate(vm, id.link);
       return 0;
    }
    return prev;
@@ -403,15 +423,16 @@ int Pop(struct refal_vm *vm, rf_index prev, rf_index next)
       assert(vm->u[id.link].op == rf_sentence);
       if (vm->u[id.link].op != rf_sentence)
          return prev;
-      rf_index s_next = vm->u[id.link].link;
+      rf_index s_next = RF_VALUE(vm, id.link).link;
       assert(vm->u[s_next].op == rf_sentence || vm->u[s_next].op == rf_name);
       rf_splice_evar_prev(vm, id.link, s_next, next);
+      rf_charset_invalidate(vm, id.link);
       // id.value менять нельзя, потому первую rf_sentence не удаляем.
       // Таким образом из пустого ящика всегда извлекается пустая e-переменная.
       if (vm->u[s_next].op == rf_name)
          return 0;
       if (vm->u[s_next].op == rf_sentence) {
-         vm->u[id.link].data = vm->u[s_next].link;
+         RF_VALUE(vm, id.link).data = RF_VALUE(vm, s_next).link;
          rf_free_evar(vm, id.link, vm->u[s_next].next);
          return 0;
       }
@@ -441,7 +462,7 @@ int Type(struct refal_vm *vm, rf_index prev, rf_index next)
          type = 'B';
          break;
       case rf_char:
-         switch (vm->u[s].chr) {
+         switch (RF_VALUE(vm, s).chr) {
          case '0'...'9':
             type = 'D';
             break;
@@ -472,55 +493,69 @@ int Type(struct refal_vm *vm, rf_index prev, rf_index next)
    return 0;
 }
 
-int Numb(struct refal_vm *vm, rf_index prev, rf_index next)
+int rf_numb_reader(struct refal_vm *vm, rf_index prev, rf_index next)
 {
    rf_int result = 0;
    for (rf_index s = vm->u[prev].next; s != next; s = vm->u[s].next) {
       if (vm->u[s].op != rf_char)
          break;
-      wchar_t c = vm->u[s].chr;
+      wchar_t c = RF_VALUE(vm, s).chr;
       if (c < '0' || c > '9')
          break;
       result = 10 * result + c - '0';
    }
-   rf_free_evar(vm, prev, next);
-   rf_alloc_int(vm, result);
+   rf_data data;
+   if (!rf_num_data(vm, result, &data))
+      return vm->u[prev].next;
+   rf_alloc_value(vm, data, rf_number);
    return 0;
 }
 
+int Numb(struct refal_vm *vm, rf_index prev, rf_index next)
+{
+   int r = rf_numb_reader(vm, prev, next);
+   if (!r)
+      rf_free_evar(vm, prev, next);
+   return r;
+}
+
 int Symb(struct refal_vm *vm, rf_index prev, rf_index next)
 {
    rf_index s = vm->u[prev].next;
    if (s == next || vm->u[s].op != rf_number || vm->u[s].next != next)
       return s;
 
-   rf_int num = vm->u[s].num;
+   rf_int num = rf_num(vm, s);
    rf_free_evar(vm, prev, next);
 
    // TODO учесть остальные архитектуры.
    unsigned long unum = num;
-   if (num < 0) {
+   if (num < 0)
       unum = -num;
-      rf_alloc_char(vm, '-');
-   }
-   char digits[8 * sizeof(unum) * /* lg(2) */ 3/10];
-   unsigned n = 0;
+   // Цифры размещаются в буфере справа налево, затем — одним блоком ячеек.
+   char digits[1 + 8 * sizeof(unum) * /* lg(2) */ 3/10];
+   char *const end = digits + sizeof(digits);
+   char *p = end;
    do {
-      assert(n < sizeof(digits));
-      digits[n++] = unum % 10 + '0';
+      assert(p != digits);
+      *--p = unum % 10 + '0';
       unum /= 10;
    } while (unum);
-   while (n--) {
-      rf_alloc_char(vm, digits[n]);
-   }
+   if (num < 0)
+      *--p = '-';
+   unsigned state = 0;
+   rf_alloc_utf8(vm, p, end - p, &state);
    return 0;
 }
 
+// Ячейки изменяются на месте, потому свёртки термов в скобках сбрасываются.
 int Ord(struct refal_vm *vm, rf_index prev, rf_index next)
 {
    for (rf_index s = vm->u[prev].next; s != next; s = vm->u[s].next) {
       if (vm->u[s].op == rf_char)
          vm->u[s].op = rf_number;
+      else if (vm->u[s].op == rf_opening_bracket)
+         rf_bracket_hash_assign(vm, s, 0);
    }
    return 0;
 }
@@ -530,12 +565,14 @@ int Chr(struct refal_vm *vm, rf_index prev, rf_index next)
    for (rf_index s = vm->u[prev].next; s != next; s = vm->u[s].next) {
       if (vm->u[s].op == rf_number)
          vm->u[s].op = rf_char;
+      else if (vm->u[s].op == rf_opening_bracket)
+         rf_bracket_hash_assign(vm, s, 0);
    }
    return 0;
 }
 
 
-int GetEnv(struct refal_vm *vm, rf_index prev, rf_index next)
+int rf_getenv_reader(struct refal_vm *vm, rf_index prev, rf_index next)
 {
    extern char **environ;
    rf_index name = vm->u[prev].next;
@@ -563,21 +600,28 @@ next_var:
       ++env;
    }
 exit:
-   rf_free_evar(vm, prev, next);
    return 0;
 }
 
+int GetEnv(struct refal_vm *vm, rf_index prev, rf_index next)
+{
+   int r = rf_getenv_reader(vm, prev, next);
+   if (!r)
+      rf_free_evar(vm, prev, next);
+   return r;
+}
+
 int Exit(const struct refal_vm *vm, rf_index prev, rf_index next)
 {
    rf_index s = vm->u[prev].next;
    if (s == next || vm->u[s].op != rf_number || vm->u[s].next != next)
       return s;
 
-   rf_int status = vm->u[s].num;
+   rf_int status = rf_num(vm, s);
    exit(status);
 }
 
-int System(struct refal_vm *vm, rf_index prev, rf_index next)
+int rf_system_reader(struct refal_vm *vm, rf_index prev, rf_index next)
 {
    // TODO PATH_MAX имеет отдалённое отношение к system().
    char path[PATH_MAX + 4];
@@ -595,8 +639,14 @@ int System(struct refal_vm *vm, rf_index prev, rf_index next)
    } else {
       res = system(NULL);
    }
-
-   rf_free_evar(vm, prev, next);
    rf_alloc_int(vm, res);
    return 0;
 }
+
+int System(struct refal_vm *vm, rf_index prev, rf_index next)
+{
+   int r = rf_system_reader(vm, prev, next);
+   if (!r)
+      rf_free_evar(vm, prev, next);
+   return r;
+}
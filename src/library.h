@@ -192,6 +192,104 @@ int Mod(struct refal_vm *vm, rf_index prev, rf_index next);
  */
 int Compare(struct refal_vm *vm, rf_index prev, rf_index next);
 
+/**
+ * Операции арифметических функций. Вызов с двумя операндами — числами либо
+ * s-переменными — отмечается транслятором (`rf_op_call_arith`), и над
+ * числами исполнитель вычисляет результат на месте, без вызова функции.
+ */
+typedef enum rf_arith {
+   rf_arith_none,
+   rf_arith_add,
+   rf_arith_sub,
+   rf_arith_mul,
+   rf_arith_div,
+   rf_arith_mod,
+   rf_arith_compare,
+} rf_arith;
+
+static_assert((int)rf_arith_compare <= (int)rf_op_call_arith, "Операция хранится в режиме опкода.");
+
+/**
+ * Определяет операцию, выполняемую библиотечной функцией.
+ */
+static inline
+rf_arith rf_arith_function(rf_function *f)
+{
+   return f == &Add ? rf_arith_add
+        : f == &Sub ? rf_arith_sub
+        : f == &Mul ? rf_arith_mul
+        : f == &Div ? rf_arith_div
+        : f == &Mod ? rf_arith_mod
+        : f == &Compare ? rf_arith_compare
+        : rf_arith_none;
+}
+
+/**
+ * Части функций Prout, Putout, Open, Numb, GetEnv и System, не изменяющие
+ * аргумента. Результат размещается в свободной части списка (следом за
+ * аргументом), аргумент освобождает вызывающая сторона. При невозможности
+ * отождествления ничего не размещается.
+ */
+rf_function  rf_prout_reader;
+rf_function  rf_putout_reader;
+rf_function  rf_open_reader;
+rf_function  rf_numb_reader;
+rf_function  rf_getenv_reader;
+rf_function  rf_system_reader;
+
+/**
+ * Определяет функцию, выполняющую вызов библиотечной функции `f` без
+ * изменения аргумента, после чего аргумент остаётся лишь освободить.
+ * Копии e-переменных в аргументе такого вызова не создаются: значение
+ * переменной переносится в аргумент и возвращается на место по завершении
+ * (отмечается транслятором, см. `rf_op_var_borrow`).
+ * \result NULL, если функция изменяет аргумент.
+ */
+static inline
+rf_function *rf_reader_function(rf_function *f)
+{
+   return f == &Prout  ? &rf_prout_reader
+        : f == &Putout ? &rf_putout_reader
+        : f == &Open   ? &rf_open_reader
+        : f == &Numb   ? &rf_numb_reader
+        : f == &GetEnv ? &rf_getenv_reader
+        : f == &System ? &rf_system_reader
+        : NULL;
+}
+
+/**
+ * Вычисляет арифметическую операцию (кроме сравнения).
+ * При делении на 0 результат 0.
+ */
+static inline
+rf_int rf_arith_eval(rf_arith op, rf_int s1, rf_int s2)
+{
+   switch (op) {
+   case rf_arith_add:   return s1 + s2;
+   case rf_arith_sub:   return s1 - s2;
+   case rf_arith_mul:   return s1 * s2;
+   case rf_arith_div:   return s2 ? s1/s2 : s2;
+   case rf_arith_mod:   return s2 ? s1%s2 : s2;
+   default:             assert(0); return 0;
+   }
+}
+
+/**
+ * Добавляет в свободную часть списка результат операции над числами
+ * и возвращает номер ячейки.
+ */
+static inline
+rf_index rf_alloc_arith(
+      struct refal_vm   *vm,
+      rf_arith          op,
+      rf_int            s1,
+      rf_int            s2)
+{
+   if (op == rf_arith_compare)
+      return rf_alloc_char(vm, s1 < s2 ? '-' : s1 > s2 ? '+' : '0');
+   return rf_alloc_int(vm, rf_arith_eval(op, s1, s2));
+}
+
 /**\}*/
 
 /**\addtogroup library-stack
@@ -6,6 +6,7 @@
 #include <sys/mman.h>
 
 #include <locale.h>
+#include <unistd.h>
 
 #include "library.h"
 #include "interpreter.h"
@@ -18,28 +19,228 @@
 #define REFAL_ATOM_INITIAL_MEMORY (128*1024/sizeof(wchar_t))
 #define REFAL_TRIE_INITIAL_MEMORY (128*1024/sizeof(struct rtrie_node))
 
-#define REFAL_INTERPRETER_CALL_STACK_LIMIT   (8*1024*1024)
-#define REFAL_INTERPRETER_CALL_STACK         (32*1024)
-#define REFAL_INTERPRETER_VAR_STACK          (64*1024)
-#define REFAL_INTERPRETER_BRACKET_STACK      (4*1024)
+/// Стеки исполнителя хранят индексы ячеек; их размеры в байтах растут вместе
+/// с индексом (`REFAL_INDEX_WIDE`), чтобы глубина рекурсии не зависела от сборки.
+#define REFAL_INTERPRETER_STACK(bytes)       ((bytes)/sizeof(uint32_t)*sizeof(rf_index))
+
+#define REFAL_INTERPRETER_CALL_STACK_LIMIT   REFAL_INTERPRETER_STACK(8*1024*1024)
+#define REFAL_INTERPRETER_CALL_STACK         REFAL_INTERPRETER_STACK(32*1024)
+#define REFAL_INTERPRETER_VAR_STACK          REFAL_INTERPRETER_STACK(64*1024)
+#define REFAL_INTERPRETER_BRACKET_STACK      REFAL_INTERPRETER_STACK(4*1024)
+
+/// Размер крупной страницы, меньшие блоки памяти не затрагиваются.
+#define REFAL_HUGE_PAGE_SIZE                 (2*1024*1024)
+
+/**
+ * Размещать память крупными страницами (ключ +h).
+ * Случайный обход списка ячеек, занимающего сотни мегабайт, сопровождается
+ * промахами TLB; крупные страницы сокращают их количество.
+ * Используются прозрачные крупные страницы (THP): в отличие от MAP_HUGETLB
+ * не требуют предварительного резервирования и допускают увеличение блока
+ * посредством mremap(). При отсутствии поддержки madvise() завершается
+ * ошибкой, которая игнорируется, и память размещается обычными страницами.
+ */
+static int huge_pages = 0;
+
+static inline
+void *advise_huge_pages(void *p, size_t size)
+{
+   if (huge_pages && p != MAP_FAILED && size >= REFAL_HUGE_PAGE_SIZE)
+      madvise(p, size, MADV_HUGEPAGE);
+   return p;
+}
+
+/// Объём резервируемого адресного пространства для блока памяти.
+#define REFAL_RESERVE_SIZE                   ((size_t)1 << 36)
+/// Количество одновременно существующих резервов.
+#define REFAL_RESERVATIONS                   16
+
+/**
+ * Резервировать адресное пространство (ключ +r).
+ * При увеличении блока посредством mremap() он может быть перемещён, что
+ * требует работы с таблицами страниц и обесценивает сохранённые указатели.
+ * В данном режиме для каждого блока единожды резервируется обширная область
+ * (PROT_NONE, MAP_NORESERVE — без выделения физической памяти), страницы
+ * которой становятся доступными по мере роста блока (mprotect), так что
+ * начальный адрес неизменен. Блоки сверх числа резервов и превысившие резерв
+ * размещаются обычным образом.
+ */
+static int reserve = 0;
+
+static size_t page_size = 4096;
+
+static struct reservation {
+   char     *p;      ///< Начало области (и блока памяти).
+   size_t   size;    ///< Размер зарезервированной области.
+} reservations[REFAL_RESERVATIONS];
+
+static inline
+struct reservation *find_reservation(const void *p)
+{
+   for (unsigned i = 0; i != REFAL_RESERVATIONS; ++i) {
+      if (reservations[i].p == p)
+         return &reservations[i];
+   }
+   return NULL;
+}
+
+static inline
+char *page_floor(char *p)
+{
+   return (char*)((uintptr_t)p & ~(page_size - 1));
+}
+
+static inline
+char *page_ceil(char *p)
+{
+   return page_floor(p + page_size - 1);
+}
+
+/// Количество одновременно защищённых от записи участков памяти.
+#define REFAL_PROTECTIONS                    4
+
+/**
+ * Участки памяти, защищённые от записи (`refal_protect()`).
+ * mremap() не переносит область, страницы которой защищены различным
+ * образом, потому на время изменения размера блока защита снимается
+ * и восстанавливается по новому адресу.
+ */
+static struct protection {
+   char     *begin;  ///< Первая защищённая страница.
+   char     *end;    ///< Следующая за последней защищённой страница.
+} protections[REFAL_PROTECTIONS];
+
+static inline
+int protection_within(const struct protection *pr, const void *ptr, size_t size)
+{
+   return pr->begin && (char*)ptr <= pr->begin && pr->end <= (char*)ptr + size;
+}
+
+/**
+ * Изменяет размер блока посредством mremap() (с возможным переносом),
+ * сохраняя защиту его участков от записи.
+ */
+static inline
+void *remap_protected(void *ptr, size_t old_size, size_t new_size)
+{
+   for (unsigned i = 0; i != REFAL_PROTECTIONS; ++i) {
+      struct protection *pr = &protections[i];
+      if (protection_within(pr, ptr, old_size))
+         mprotect(pr->begin, pr->end - pr->begin, PROT_READ|PROT_WRITE);
+   }
+   char *p = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE, NULL);
+   for (unsigned i = 0; i != REFAL_PROTECTIONS; ++i) {
+      struct protection *pr = &protections[i];
+      if (!protection_within(pr, ptr, old_size))
+         continue;
+      if (p != MAP_FAILED) {
+         pr->begin = p + (pr->begin - (char*)ptr);
+         pr->end   = p + (pr->end - (char*)ptr);
+         if (!protection_within(pr, p, new_size)) {
+            *pr = (struct protection) { };
+            continue;
+         }
+      }
+      mprotect(pr->begin, pr->end - pr->begin, PROT_READ);
+   }
+   return p;
+}
 
 void *refal_malloc(size_t size)
 {
+   struct reservation *r = reserve && sizeof(size_t) > 4 ? find_reservation(NULL) : NULL;
+   if (r) {
+      size_t reserved = size > REFAL_RESERVE_SIZE ? size : REFAL_RESERVE_SIZE;
+      void *p = mmap(NULL, reserved, PROT_NONE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+      if (p != MAP_FAILED) {
+         if (!mprotect(p, size, PROT_READ|PROT_WRITE)) {
+            *r = (struct reservation) { p, reserved };
+            return advise_huge_pages(p, reserved);
+         }
+         munmap(p, reserved);
+      }
+   }
    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   p = advise_huge_pages(p, size);
    return p != MAP_FAILED ? p : NULL;
 }
 
 void *refal_realloc(void *ptr, size_t old_size, size_t new_size)
 {
-   void *p = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE, NULL);
+   struct reservation *r = find_reservation(ptr);
+   if (r && new_size <= r->size) {
+      char *old_end = r->p + old_size;
+      char *new_end = r->p + new_size;
+      if (new_size > old_size) {
+         char *commit = page_floor(old_end);
+         if (mprotect(commit, new_end - commit, PROT_READ|PROT_WRITE))
+            return NULL;
+      } else if (page_ceil(new_end) < old_end) {
+         // Возвращаем страницы системе, сохраняя резерв.
+         char *release = page_ceil(new_end);
+         madvise(release, old_end - release, MADV_DONTNEED);
+         mprotect(release, old_end - release, PROT_NONE);
+      }
+      return ptr;
+   }
+   // Резерв исчерпан: блок переносится целиком и далее не резервируется.
+   if (r) {
+      mprotect(ptr, r->size, PROT_READ|PROT_WRITE);
+      old_size = r->size;
+      *r = (struct reservation) { };
+   }
+   void *p = remap_protected(ptr, old_size, new_size);
+   p = advise_huge_pages(p, new_size);
    return p != MAP_FAILED ? p : NULL;
 }
 
 void refal_free(void *ptr, size_t size)
 {
+   struct reservation *r = find_reservation(ptr);
+   if (r) {
+      size = r->size;
+      *r = (struct reservation) { };
+   }
+   for (unsigned i = 0; i != REFAL_PROTECTIONS; ++i) {
+      if (protection_within(&protections[i], ptr, size))
+         protections[i] = (struct protection) { };
+   }
    munmap(ptr, size);
 }
 
+void refal_protect(void *ptr, size_t size)
+{
+   char *begin = page_ceil(ptr);
+   char *end = page_floor((char*)ptr + size);
+   if (!(begin < end))
+      return;
+   for (unsigned i = 0; i != REFAL_PROTECTIONS; ++i) {
+      struct protection *pr = &protections[i];
+      if (!pr->begin || pr->begin == begin) {
+         if (pr->begin && end < pr->end)
+            mprotect(end, pr->end - end, PROT_READ|PROT_WRITE);
+         if (!mprotect(begin, end - begin, PROT_READ))
+            *pr = (struct protection) { begin, end };
+         return;
+      }
+   }
+}
+
+void refal_unprotect(void *ptr, size_t size)
+{
+   (void)size;
+   char *begin = page_ceil(ptr);
+   for (unsigned i = 0; i != REFAL_PROTECTIONS; ++i) {
+      struct protection *pr = &protections[i];
+      if (pr->begin && pr->begin == begin) {
+         mprotect(pr->begin, pr->end - pr->begin, PROT_READ|PROT_WRITE);
+         *pr = (struct protection) { };
+         return;
+      }
+   }
+}
+
 int main(int argc, char **argv)
 {
    int r = -1;
@@ -55,7 +256,11 @@ int main(int argc, char **argv)
          .notice_copy               = 0,
    };
 
+   // Упорядочивание ячеек РЕФАЛ-машины по умолчанию включено.
+   int compact = 1;
+
    setlocale(LC_ALL, "");
+   page_size = sysconf(_SC_PAGESIZE);
 
    // 0-й параметр пропускаем (содержит имя исполняемого файла).
    // Начинающиеся с + и - параметры считаем ключами исполнителю.
@@ -91,6 +296,21 @@ int main(int argc, char **argv)
             goto option_unrecognized;
          tcfg.warn_implicit_declaration = flag;
          break;
+      case 'c':
+         if (argv[0][2])
+            goto option_unrecognized;
+         compact = flag;
+         break;
+      case 'h':
+         if (argv[0][2])
+            goto option_unrecognized;
+         huge_pages = flag;
+         break;
+      case 'r':
+         if (argv[0][2])
+            goto option_unrecognized;
+         reserve = flag;
+         break;
       case 'v':
          if (argv[0][2])
             goto option_unrecognized;
@@ -112,7 +332,7 @@ arguments:
       return EXIT_FAILURE;
    }
 
-   // Память РЕФАЛ-машины (исполняемые опкоды и поле зрения совмещены).
+   // Память РЕФАЛ-машины (исполняемые опкоды предшествуют полю зрения).
    struct refal_vm   vm;
    refal_vm_init(&vm, REFAL_INITIAL_MEMORY, REFAL_ATOM_INITIAL_MEMORY);
    if (refal_vm_check(&vm, &status)) {
@@ -126,7 +346,12 @@ arguments:
          vm.library = library;
          vm.library_size = refal_import(&ids, vm.library);
 
-         refal_translate_file_to_bytecode(&tcfg, &vm, &ids, *argv, &status);
+         if (!refal_translate_file_to_bytecode(&tcfg, &vm, &ids, *argv, &status))
+            refal_translate_layout(&vm, &ids);
+         // Имена идентификаторов далее не добавляются.
+         wstr_shrink(&vm.id);
+         rtrie_shrink(&ids);
+         rtrie_hash_names(&ids);
 
          // Границы поля зрения:
          rf_index next = vm.free;
@@ -196,8 +421,9 @@ arguments:
                .brackets_stack_size = REFAL_INTERPRETER_BRACKET_STACK,
                .boxed_patterns      = 0,
                .locals              = tcfg.locals_limit,
+               .compact_fragments   = compact ? REFAL_INTERPRETER_COMPACT_FRAGMENTS : 0,
             };
-            r = refal_run_opcodes(&cfg, &vm, prev, next, entry.link, &status);
+            r = refal_run_opcodes(&cfg, &vm, &prev, &next, entry.link, &status);
             // В случае ошибки среды, она выведена исполнителем.
             if (r > 0) {
                puts("Отождествление невозможно.");
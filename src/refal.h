@@ -39,6 +39,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wchar.h>
 
 /**\addtogroup internal Внутреннее устройство РЕФАЛ-машины.
@@ -80,28 +81,107 @@ typedef enum rf_opcode {
 static_assert(rf_evar < 1<<4, "Значение хранится в 4-х разрядах.");
 
 /**
- *  Дополнительные режимы кодов операций РЕФАЛ-машины.
+ *  Дополнительные режимы кодов операций РЕФАЛ-машины (разряды).
+ *  Значение разряда определяется кодом операции.
  */
 typedef enum rf_op_mode {
    rf_op_default,
-   rf_op_var_copy      = 1,   // Пока действительно любое отличное от 0.
-   rf_op_exec_tailcall = 1,
+   rf_op_var_copy       = 1,  ///< t- e-переменная: вхождение не последнее.
+   rf_op_var_borrow     = 2,  ///< e-переменная (копия): значение заимствуется на время вызова.
+   rf_op_exec_tailcall  = 1,  ///< rf_execute: хвостовой вызов.
+   rf_op_exec_borrow    = 2,  ///< rf_execute: аргумент содержит заимствованные значения (см. `rf_reader_function()`).
+   // Составные команды (см. `refal_translate_layout()`).
+   rf_op_sentence_empty = 1,  ///< rf_sentence: образец пуст (далее rf_equal).
+   rf_op_sentence_index = 2,  ///< rf_sentence: начало серии в `vm->dispatch`.
+   rf_op_call_next      = 1,  ///< rf_equal: далее rf_open_function.
+   rf_op_call_arith     = 7,  ///< rf_open_function: операция (`rf_arith`) встроенной функции, далее два операнда.
+   rf_op_literal_next   = 2,  ///< Символ, число, s-переменная: далее символ либо число.
+   // e-переменная образца (`rf_op_var_copy` для неё не используется).
+   rf_op_evar_tail      = 7,  ///< Наименьшее количество термов далее до конца уровня скобок.
+   rf_op_evar_rigid     = 8,  ///< Далее ровно `rf_op_evar_tail` термов, без e-переменных.
 } rf_op_mode;
 
-static_assert(rf_op_exec_tailcall < 1<<4, "Значение хранится в 4-х разрядах.");
+static_assert((rf_op_evar_rigid | rf_op_evar_tail) < 1<<4, "Значение хранится в 4-х разрядах.");
+
+/**\addtogroup layout Варианты размещения ячеек.
+ * \{
+ *
+ * Задаются при сборке (например, `make DEFINES=-DREFAL_CELL_COMPACT=1`).
+ *
+ * `REFAL_CELL_COMPACT` сокращает поле данных ячейки до 32-х разрядов, размер
+ * ячейки при этом уменьшается с 16-ти до 12-ти байт. Символы Уникода и ссылки
+ * помещаются полностью, макроцифры же, не помещающиеся в значение, хранятся
+ * в отдельной таблице РЕФАЛ-машины (см. `rf_num_data()`), а ячейка содержит
+ * индекс в ней.
+ * Сократить ячейку до 8-ми байт невозможно, не отказавшись от двусвязного
+ * списка: индексы `prev` и `next` вместе с тегом занимают 60 разрядов.
+ *
+ * `REFAL_INDEX_WIDE` расширяет индексы до 60-ти разрядов, снимая ограничение
+ * в 256М ячеек ценой увеличения размера ячейки до 24-х байт.
+ *
+ * `REFAL_CELL_SOA` размещает значения ячеек отдельным массивом, параллельным
+ * массиву тегов и ссылок (структура массивов вместо массива структур).
+ * При сопоставлении с образцом, обходящем список и проверяющем теги, в кеш
+ * при этом загружается вдвое меньше данных, но обращение к значению требует
+ * загрузки из другого массива.
+ *
+ * `REFAL_BRACKET_HASH` хранит в старших 32-х разрядах значения открывающей
+ * скобки свёртку заключённого терма (см. `rf_bracket_hash()`), позволяя
+ * различать термы в скобках без обхода. Возможно лишь при полноразмерном
+ * значении и 32-х разрядных индексах (по умолчанию в этом случае включено).
+ */
+#ifndef REFAL_CELL_COMPACT
+#define REFAL_CELL_COMPACT 0
+#endif
+
+#ifndef REFAL_INDEX_WIDE
+#define REFAL_INDEX_WIDE 0
+#endif
+
+#ifndef REFAL_CELL_SOA
+#define REFAL_CELL_SOA 0
+#endif
+
+#if REFAL_CELL_COMPACT && REFAL_INDEX_WIDE
+#error "REFAL_CELL_COMPACT и REFAL_INDEX_WIDE несовместимы"
+#endif
+
+#ifndef REFAL_BRACKET_HASH
+#define REFAL_BRACKET_HASH (!REFAL_CELL_COMPACT && !REFAL_INDEX_WIDE)
+#endif
+
+#if REFAL_BRACKET_HASH && (REFAL_CELL_COMPACT || REFAL_INDEX_WIDE)
+#error "REFAL_BRACKET_HASH несовместим с REFAL_CELL_COMPACT и REFAL_INDEX_WIDE"
+#endif
+/**\}*/
 
 /**
  * Адресует ячейки памяти РЕФАЛ-машины.
  */
+#if REFAL_INDEX_WIDE
+typedef uint64_t rf_index;
+#define RF_INDEX_BITS 60
+#else
 typedef uint32_t rf_index;
+#define RF_INDEX_BITS 28
+#endif
 
-enum { rf_index_max = (1 << 28) - 1 };
+static const rf_index rf_index_max = ((rf_index)1 << RF_INDEX_BITS) - 1;
 
 /**
  * Целочисленное значение в ячейке.
  */
 typedef long rf_int;
 
+/**
+ * Данные ячейки в виде, пригодном для сравнения.
+ */
+#if REFAL_CELL_COMPACT
+typedef uint32_t rf_data;
+#else
+typedef uint64_t rf_data;
+#endif
+
 /**
  * Индекс для адресации ячеек массива, где хранятся строки.
  */
@@ -131,9 +211,30 @@ typedef enum rf_id_type {
  */
 typedef struct rf_id {
    rf_id_type  tag :4;  ///< Тип идентификатора.
-   rf_index    link:28; ///< Индекс (ячейки РЕФАЛ-машины или таблице импорта).
+   rf_index    link:RF_INDEX_BITS; ///< Индекс (ячейки РЕФАЛ-машины или таблице импорта).
 } rf_id;
 
+/**
+ * Значение ячейки памяти РЕФАЛ-машины.
+ * Доступ к значению ячейки `i` осуществляется посредством `RF_VALUE(vm, i)`,
+ * что позволяет выбрать размещение (см. `REFAL_CELL_SOA`).
+ */
+typedef union rf_value {
+   //TODO не хочется делать «сеттер», но записывать двойные слова лучше только сюда.
+   rf_data     data;    ///< Используется для сравнения.
+#if !REFAL_CELL_COMPACT
+   rf_int      num;     ///< Число (чтение посредством `rf_num()`).
+#endif
+   wchar_t     chr;     ///< Символ (буква).
+#if REFAL_CELL_COMPACT
+   uint32_t    name;    ///< Индекс первого символа имени идентификатора (хранятся отдельно).
+#else
+   wstr_index  name;    ///< Индекс первого символа имени идентификатора (хранятся отдельно).
+#endif
+   rf_index    link;    ///< Узел в графе.
+   rf_id       id;      ///< Ссылка на первый опкод функции.
+} rf_value;
+
 /**
  * Ячейка памяти РЕФАЛ-машины.
  *
@@ -148,23 +249,70 @@ typedef struct rf_id {
  * поскольку приходится хранить тип данных (технически, тег можно разместить в
  * младших разрядах хранимого значения: для указателей на выровненные данные они
  * равны 0, а размер целого числа, например, в OCaml, сокращён на 1 бит).
+ * Сокращённый вариант ячейки (12 байт) см. `REFAL_CELL_COMPACT`,
+ * расширенный (24 байта) — `REFAL_INDEX_WIDE`.
+ * При `REFAL_CELL_SOA` значения хранятся в отдельном массиве, а ячейка
+ * содержит лишь теги и ссылки.
  */
 typedef struct rf_cell {
-   union {
-      //TODO не хочется делать «сеттер», но записывать двойные слова лучше только сюда.
-      uint64_t    data;    ///< Используется для сравнения.
-      rf_int      num;     ///< Число.
-      wchar_t     chr;     ///< Символ (буква).
-      wstr_index  name;    ///< Индекс первого символа имени идентификатора (хранятся отдельно).
-      rf_index    link;    ///< Узел в графе.
-      rf_id       id;      ///< Ссылка на первый опкод функции.
-   };
+#if !REFAL_CELL_SOA
+   rf_value    v;          ///< Значение (см. `RF_VALUE()`).
+#endif
    rf_opcode   op  :4;     ///< Код операции.
-   rf_index    prev:28;    ///< Индекс предыдущей ячейки.
+   rf_index    prev:RF_INDEX_BITS; ///< Индекс предыдущей ячейки.
    rf_index    mode:4;     ///< Вспомогательный код операции.
-   rf_index    next:28;    ///< Индекс последующей ячейки.
+   rf_index    next:RF_INDEX_BITS; ///< Индекс последующей ячейки.
 } rf_cell;
 
+#if REFAL_CELL_SOA
+static_assert(sizeof(rf_cell) == (REFAL_INDEX_WIDE ? 16 : 8), "размер ячейки");
+/// Значение ячейки `i` (в отдельном массиве).
+#define RF_VALUE(vm, i) ((vm)->v[i])
+#else
+static_assert(sizeof(rf_cell) == (REFAL_CELL_COMPACT ? 12 : REFAL_INDEX_WIDE ? 24 : 16), "размер ячейки");
+/// Значение ячейки `i`.
+#define RF_VALUE(vm, i) ((vm)->u[i].v)
+#endif
+
+/**
+ * Элемент таблицы выбора предложения.
+ *
+ * Для серии предложений функции, образцы которых начинаются литералом,
+ * содержит первое из них, образец которого начинается данным литералом.
+ * Ссылки предложений серии (`rf_sentence`) указывают на следующее предложение
+ * с тем же литералом, так что прочие не сопоставляются. Элемент с тегом
+ * `rf_undefined` указывает на завершающую серию команду.
+ */
+struct rf_dispatch {
+   rf_index    run;        ///< Первое предложение серии, 0 — элемент свободен.
+   rf_index    sentence;   ///< Первое подходящее предложение.
+   rf_data     data;       ///< Значение литерала.
+   rf_opcode   op;         ///< Тег литерала.
+};
+
+/**
+ * Множество символов «полного» ящика, все варианты которого (в том числе
+ * вложенных ящиков) — одиночные символы. Позволяет сопоставить ящик в образце
+ * проверкой принадлежности вместо перебора вариантов (см. `rf_charset_get()`).
+ */
+struct rf_charset {
+   rf_index    box;        ///< Заголовок ящика, 0 — элемент свободен.
+   int         valid;      ///< Ящики не изменялись после построения.
+   int         usable;     ///< Ящик содержит лишь одиночные символы.
+   /// Заголовки ящика и вложенных в него (изменение которых требует
+   /// перестроить множество, см. `rf_charset_invalidate()`).
+   rf_index    boxes[8];
+   unsigned    nboxes;
+   uint64_t    bmp[0x10000 / 64]; ///< Символы BMP.
+   /// Прочие символы, числа и идентификаторы (открытая адресация,
+   /// `rf_undefined` — элемент свободен, заполнено не более половины).
+   struct {
+      rf_data     data;
+      rf_opcode   op;
+   } other[32];
+   unsigned    others;
+};
+
 /**
  * Описатель РЕФАЛ-машины.
  *
@@ -180,13 +328,44 @@ typedef struct rf_cell {
  */
 struct refal_vm {
    rf_cell     *u;   ///< Массив, содержащий ячейки.
+#if REFAL_CELL_SOA
+   rf_value    *v;   ///< Массив значений ячеек (параллельный `u`).
+#endif
    rf_index    size; ///< Размер массива.
    rf_index    free; ///< Первый свободный элемент.
+   rf_index    tail; ///< Завершающий список элемент (далее ячейки не инициализированы).
+   /// Количество освобождённых фрагментов с момента упорядочивания ячеек.
+   /// Служит мерой фрагментации списка (см. `refal_vm_compact()`).
+   rf_index    fragments;
+   /// Последняя ячейка исполняемого кода (см. `refal_translate_layout()`).
+   /// Ячейки с 1-й по `code` при исполнении не изменяются; 0 — не выделен.
+   rf_index    code;
+
+   /// Таблица выбора предложения по первому элементу поля зрения
+   /// (см. `rf_dispatch_slot()`), размер — степень 2.
+   struct rf_dispatch   *dispatch;
+   rf_index             dispatch_size;
+
+   /// Множества символов ящиков, сопоставляемых в образцах
+   /// (см. `rf_charset_get()`), размер — степень 2.
+   struct rf_charset    *charset;
+   rf_index             charset_size;
+   rf_index             charsets;   ///< Количество занятых элементов.
+
+#if REFAL_CELL_COMPACT
+   /// Макроцифры, не помещающиеся в значение ячейки (см. `rf_num_data()`).
+   rf_int      *wide;
+   /// Индексы `wide` (увеличенные на 1, 0 — элемент свободен) по значению,
+   /// размер вдвое больше `wide_size`.
+   rf_index    *wide_hash;
+   rf_index    wide_size;  ///< Размер `wide` — степень 2.
+   rf_index    wides;      ///< Количество занятых элементов `wide`.
+#endif
 
    struct wstr id;   ///<  Хранилище имён идентификаторов. Разделены L'\0'.
 
-   /// Дерево поиска имён для Mu. Возможно, следует заменить на идеальный хеш.
-   const struct refal_trie *rt;
+   /// Дерево поиска имён для Mu, Push и Pop (с хеш-таблицей полных имён).
+   struct refal_trie *rt;
 
    /// Адрес таблицы функций в машинном коде.
    const struct refal_import_descriptor *library;
@@ -211,7 +390,7 @@ struct refal_vm {
 void *refal_malloc(size_t size);
 
 /**
- * Изменяет (увеличивает) размер запрошенной ранее памяти.
+ * Изменяет (увеличивает либо сокращает) размер запрошенной ранее памяти.
  * \param ptr начальный адрес памяти (результат `refal_malloc()`).
  * \param old_size ранее распределённый объём памяти.
  * \param new_size требуемый объём памяти.
@@ -224,6 +403,23 @@ void *refal_realloc(void *ptr, size_t old_size, size_t new_size);
  * \param ptr начальный адрес памяти (результат `refal_malloc()`).
  */
 void refal_free(void *ptr, size_t size);
+
+/**
+ * Запрещает запись в часть распределённой памяти (исполняемый код).
+ * Реализация может игнорировать запрос. Защита сохраняется при изменении
+ * размера блока и снимается при его освобождении.
+ * \param ptr начальный адрес защищаемой части (не обязательно выровнен).
+ * \param size объём защищаемой части.
+ */
+void refal_protect(void *ptr, size_t size);
+
+/**
+ * Снимает запрет записи, установленный `refal_protect()` (например, на время
+ * коррекции ссылок при упорядочивании ячеек).
+ * \param ptr начальный адрес части памяти (не обязательно выровнен).
+ * \param size объём части.
+ */
+void refal_unprotect(void *ptr, size_t size);
 /** \}*/
 
 /**\addtogroup wstring Хранилище имён идентификаторов.
@@ -291,6 +487,24 @@ wstr_index wstr_append(struct wstr *ws, wchar_t c)
       new_chr = -1;
    return new_chr;
 }
+
+/**
+ * Возвращает системе не занятую часть массива (например, по окончании
+ * трансляции, когда имена более не добавляются).
+ */
+static inline
+void wstr_shrink(struct wstr *ws)
+{
+   // Нулевой размер не позволит увеличить массив вновь.
+   wstr_index size = ws->free ? ws->free : 1;
+   if (ws->s && size < ws->size) {
+      void *p = refal_realloc(ws->s, ws->size * sizeof(*ws->s), size * sizeof(*ws->s));
+      if (p) {
+         ws->s = p;
+         ws->size = size;
+      }
+   }
+}
 /**\} addtogroup wstring   */
 
 /**
@@ -307,8 +521,28 @@ void *refal_vm_init(
       wstr_index  ids_size)   ///< Предполагаемый размер (в ячейках).
 {
    vm->u = refal_malloc(size * sizeof(rf_cell));
+#if REFAL_CELL_SOA
+   vm->v = vm->u ? refal_malloc(size * sizeof(rf_value)) : NULL;
+   if (!vm->v && vm->u) {
+      refal_free(vm->u, size * sizeof(rf_cell));
+      vm->u = NULL;
+   }
+#endif
    if (vm->u) {
       vm->size = size;
+      vm->fragments = 0;
+      vm->code = 0;
+      vm->dispatch = NULL;
+      vm->dispatch_size = 0;
+      vm->charset = NULL;
+      vm->charset_size = 0;
+      vm->charsets = 0;
+#if REFAL_CELL_COMPACT
+      vm->wide = NULL;
+      vm->wide_hash = NULL;
+      vm->wide_size = 0;
+      vm->wides = 0;
+#endif
       // 0-я ячейка зарезервирована:
       // - 0 в поле next указывает, что следует достроить список;
       // - при трансляции индекс считается не действительным (см `cmd_sentence`).
@@ -317,11 +551,43 @@ void *refal_vm_init(
       vm->free = 1;
       vm->u[vm->free] = (struct rf_cell) { .next = vm->free + 1 };
       vm->u[vm->free + 1] = (struct rf_cell) { .prev = vm->free };
+      vm->tail = vm->free + 1;
    }
    wstr_alloc(&vm->id, ids_size);
    return vm->u ? vm->id.s : NULL;
 }
 
+/**
+ * Изменяет размер массива ячеек (и массива значений, см. `REFAL_CELL_SOA`).
+ * При неудаче размеры массивов не изменяются.
+ * \result Ненулевое значение в случае успеха.
+ */
+static inline
+int refal_vm_resize(
+      struct refal_vm   *vm,
+      rf_index          new_size)
+{
+   void *p = refal_realloc(vm->u, vm->size * sizeof(rf_cell), new_size * sizeof(rf_cell));
+   if (!p)
+      return 0;
+   vm->u = p;
+#if REFAL_CELL_SOA
+   p = refal_realloc(vm->v, vm->size * sizeof(rf_value), new_size * sizeof(rf_value));
+   if (!p) {
+      // Возвращаем массиву ячеек прежний размер, сохраняя соответствие
+      // массивов и `vm->size`.
+      p = refal_realloc(vm->u, new_size * sizeof(rf_cell), vm->size * sizeof(rf_cell));
+      assert(p);
+      if (p)
+         vm->u = p;
+      return 0;
+   }
+   vm->v = p;
+#endif
+   vm->size = new_size;
+   return 1;
+}
+
 /**
  * Выделяет в памяти РЕФАЛ-машины ячейку для новых данных.
  * В случае, если индекс новой ячейки превышает допустимый, дальнейшее выделение
@@ -346,24 +612,482 @@ rf_index refal_vm_alloc_1(
       if (!vm->u[i].next) {
          return r;
       }
-      if (i + 1 >= vm->size) {
-         size_t size = vm->size * sizeof(rf_cell);
+      //TODO нет памяти.
+      if (i + 1 >= vm->size && !refal_vm_resize(vm, 2 * vm->size)) {
+         vm->free = 0;
+         return 0;
+      }
+      vm->u[i + 1].op = rf_undefined;
+      vm->u[i + 1].prev = i;
+      vm->tail = i + 1;
+   }
+   vm->free = i;
+   return r;
+}
+
+/**
+ * Выделяет в памяти РЕФАЛ-машины `n` связанных в список ячеек за одну операцию.
+ * Сначала используются освобождённые ранее ячейки; по достижении
+ * не инициализированной части массива оставшиеся ячейки размещаются в ней
+ * подряд, а список достраивается сразу на всю длину (с однократной проверкой
+ * размера массива).
+ * \result индекс первой распределённой ячейки или 0.
+ */
+static inline
+rf_index refal_vm_alloc_n(
+      struct refal_vm   *vm,
+      rf_index          n)
+{
+   assert(vm);
+   assert(vm->u);
+   assert(n);
+   rf_index r = vm->free;
+   assert(r);
+   // Проходим связанные ранее звенья.
+   rf_index i = r;
+   rf_index m = n;
+   for (; m; --m) {
+      rf_index t = vm->u[i].next;
+      if (!vm->u[t].next)
+         break;
+      i = t;
+   }
+   if (m) {
+      // Следующее за i звено завершает список, далее ячейки не инициализированы.
+      const rf_index t = vm->u[i].next;
+      if (t + m >= rf_index_max) {
+         while (n--)
+            refal_vm_alloc_1(vm);
+         return vm->free ? r : 0;
+      }
+      if (t + m >= vm->size) {
+         rf_index new_size = 2 * vm->size;
+         while (t + m >= new_size)
+            new_size *= 2;
          //TODO нет памяти.
-         void *p = refal_realloc(vm->u, size, 2 * size);
-         if (!p) {
+         if (!refal_vm_resize(vm, new_size)) {
             vm->free = 0;
             return 0;
          }
-         vm->u = p;
-         vm->size *= 2;
       }
-      vm->u[i + 1].op = rf_undefined;
-      vm->u[i + 1].prev = i;
+      for (rf_index k = t; k != t + m; ++k) {
+         vm->u[k].next = k + 1;
+         vm->u[k].mode = rf_op_default;
+         vm->u[k + 1].op = rf_undefined;
+         vm->u[k + 1].prev = k;
+      }
+      i = t + m - 1;
+      vm->tail = t + m;
    }
    vm->free = i;
    return r;
 }
 
+/**
+ * Возвращает элемент таблицы выбора предложения серии `run` для литерала
+ * либо свободный элемент, если литерал в серии не встречается.
+ */
+static inline
+struct rf_dispatch *rf_dispatch_slot(
+      const struct refal_vm   *vm,
+      rf_index                run,
+      rf_opcode               op,
+      rf_data                 data)
+{
+   assert(vm->dispatch_size);
+   const rf_index mask = vm->dispatch_size - 1;
+   uint64_t h = ((uint64_t)run << 4 | op) * 0x9e3779b97f4a7c15u
+              ^ (uint64_t)data * 0xc2b2ae3d27d4eb4fu;
+   rf_index i = (rf_index)(h ^ h >> 29) & mask;
+   while (vm->dispatch[i].run
+       && (vm->dispatch[i].run != run || vm->dispatch[i].data != data || vm->dispatch[i].op != op))
+      i = (i + 1) & mask;
+   return &vm->dispatch[i];
+}
+
+/**
+ * Возвращает элемент множества для символа (не из BMP), числа
+ * или идентификатора либо свободный элемент.
+ */
+static inline
+unsigned rf_charset_other(
+      const struct rf_charset *cs,
+      rf_opcode               op,
+      rf_data                 data)
+{
+   const unsigned mask = sizeof(cs->other) / sizeof(*cs->other) - 1;
+   uint64_t h = ((uint64_t)data << 4 | op) * 0x9e3779b97f4a7c15u;
+   unsigned i = (unsigned)(h >> 40) & mask;
+   while (cs->other[i].op != rf_undefined
+       && (cs->other[i].data != data || cs->other[i].op != op))
+      i = (i + 1) & mask;
+   return i;
+}
+
+/**
+ * Проверяет, принадлежит ли ячейка `s` множеству.
+ */
+static inline
+int rf_charset_has(
+      const struct refal_vm   *vm,
+      const struct rf_charset *cs,
+      rf_index                s)
+{
+   const rf_opcode op = vm->u[s].op;
+   const rf_data data = RF_VALUE(vm, s).data;
+   if (op == rf_char && data < 0x10000)
+      return cs->bmp[data / 64] >> data % 64 & 1;
+   return cs->other[rf_charset_other(cs, op, data)].op != rf_undefined;
+}
+
+/**
+ * Добавляет в множество варианты ящика `box` и вложенных в него ящиков.
+ * \result 0, если вариант не является одиночным символом (либо множество
+ *         переполнено).
+ */
+static inline
+int rf_charset_add(
+      const struct refal_vm   *vm,
+      struct rf_charset       *cs,
+      rf_index                box)
+{
+   const unsigned nboxes = sizeof(cs->boxes) / sizeof(*cs->boxes);
+   const unsigned others = sizeof(cs->other) / sizeof(*cs->other) / 2;
+   for (unsigned i = 0; i != cs->nboxes; ++i) {
+      if (cs->boxes[i] == box)
+         return 1;
+   }
+   if (cs->nboxes == nboxes)
+      return 0;
+   cs->boxes[cs->nboxes++] = box;
+   for (rf_index s = box; vm->u[s].op == rf_sentence; s = RF_VALUE(vm, s).link) {
+      const rf_index c = vm->u[s].next;
+      const rf_index end = RF_VALUE(vm, s).link;
+      if (c == end || vm->u[c].next != end)
+         return 0;
+      const rf_opcode op = vm->u[c].op;
+      const rf_data data = RF_VALUE(vm, c).data;
+      switch (op) {
+      case rf_char:
+         if (data < 0x10000) {
+            cs->bmp[data / 64] |= (uint64_t)1 << data % 64;
+            break;
+         }
+         [[fallthrough]];
+      case rf_number: case rf_identifier: {
+         const unsigned i = rf_charset_other(cs, op, data);
+         if (cs->other[i].op == rf_undefined) {
+            if (cs->others == others)
+               return 0;
+            ++cs->others;
+            cs->other[i].data = data;
+            cs->other[i].op = op;
+         }
+         // Идентификатор ящика совпадает как с самим собой, так и с содержимым.
+         if (op == rf_identifier && RF_VALUE(vm, c).id.tag == rf_id_box
+          && !rf_charset_add(vm, cs, RF_VALUE(vm, c).id.link))
+            return 0;
+         break;
+      }
+      default:
+         return 0;
+      }
+   }
+   return 1;
+}
+
+/**
+ * Отмечает требующими перестроения множества, включающие содержимое ящика
+ * `box` (вызывается при его изменении).
+ */
+static inline
+void rf_charset_invalidate(
+      struct refal_vm   *vm,
+      rf_index          box)
+{
+   for (rf_index i = 0; vm->charsets && i != vm->charset_size; ++i) {
+      struct rf_charset *cs = &vm->charset[i];
+      for (unsigned k = 0; cs->box && k != cs->nboxes; ++k) {
+         if (cs->boxes[k] == box)
+            cs->valid = 0;
+      }
+   }
+}
+
+/**
+ * Освобождает множества символов ящиков (например, при изменении индексов
+ * ячеек).
+ */
+static inline
+void rf_charset_clear(
+      struct refal_vm   *vm)
+{
+   for (rf_index i = 0; i != vm->charset_size; ++i)
+      vm->charset[i].box = 0;
+   vm->charsets = 0;
+}
+
+/**
+ * Возвращает множество символов ящика, заголовок которого `box`, построив
+ * (либо перестроив после изменения ящика) его при необходимости.
+ * \result NULL, если варианты ящика — не только одиночные символы, либо
+ *         недостаточно памяти.
+ */
+static inline
+const struct rf_charset *rf_charset_get(
+      struct refal_vm   *vm,
+      rf_index          box)
+{
+   assert(box);
+   if (2 * (vm->charsets + 1) > vm->charset_size) {
+      const rf_index size = vm->charset_size ? 2 * vm->charset_size : 4;
+      struct rf_charset *t = refal_malloc(size * sizeof(*t));
+      if (!t)
+         return NULL;
+      for (rf_index i = 0; i != size; ++i)
+         t[i].box = 0;
+      for (rf_index i = 0; i != vm->charset_size; ++i) {
+         if (vm->charset[i].box) {
+            rf_index k = vm->charset[i].box * 0x9e3779b9u & (size - 1);
+            while (t[k].box)
+               k = (k + 1) & (size - 1);
+            t[k] = vm->charset[i];
+         }
+      }
+      if (vm->charset)
+         refal_free(vm->charset, vm->charset_size * sizeof(*vm->charset));
+      vm->charset = t;
+      vm->charset_size = size;
+   }
+   const rf_index mask = vm->charset_size - 1;
+   rf_index i = box * 0x9e3779b9u & mask;
+   while (vm->charset[i].box && vm->charset[i].box != box)
+      i = (i + 1) & mask;
+   struct rf_charset *cs = &vm->charset[i];
+   if (!cs->box || !cs->valid) {
+      vm->charsets += !cs->box;
+      memset(cs, 0, sizeof(*cs));
+      static_assert(rf_undefined == 0, "свободный элемент множества");
+      cs->box = box;
+      cs->valid = 1;
+      cs->usable = rf_charset_add(vm, cs, box);
+   }
+   return cs->usable ? cs : NULL;
+}
+
+/**
+ * Запрещает запись в ячейки исполняемого кода (с 1-й по `vm->code`).
+ */
+static inline
+void refal_vm_protect_code(
+      struct refal_vm   *vm)
+{
+   assert(vm->code && vm->code < vm->size);
+   refal_protect(vm->u + 1, vm->code * sizeof(*vm->u));
+#if REFAL_CELL_SOA
+   refal_protect(vm->v + 1, vm->code * sizeof(*vm->v));
+#endif
+}
+
+/**
+ * Разрешает запись в исполняемый код (см. `refal_vm_protect_code()`).
+ */
+static inline
+void refal_vm_unprotect_code(
+      struct refal_vm   *vm)
+{
+   assert(vm->code && vm->code < vm->size);
+   refal_unprotect(vm->u + 1, vm->code * sizeof(*vm->u));
+#if REFAL_CELL_SOA
+   refal_unprotect(vm->v + 1, vm->code * sizeof(*vm->v));
+#endif
+}
+
+/**
+ * Возвращает новое значение индекса ячейки после `refal_vm_compact()`.
+ * Индексы за пределами массива (признаки) не изменяются.
+ */
+static inline
+rf_index rf_relocate(
+      const rf_index    *map,    ///< таблица соответствия индексов.
+      rf_index          size,    ///< размер таблицы.
+      rf_index          i)
+{
+   return i < size ? map[i] : i;
+}
+
+/**
+ * Корректирует ссылку идентификатора на ячейку после `refal_vm_compact()`.
+ * Прочие значения (номера встроенных функций, имена модулей) не изменяются.
+ */
+static inline
+struct rf_id rf_relocate_id(
+      const rf_index    *map,
+      rf_index          size,
+      struct rf_id      id)
+{
+   switch (id.tag) {
+   case rf_id_op_code: case rf_id_box: case rf_id_reference:
+      id.link = rf_relocate(map, size, id.link);
+      break;
+   default:
+      break;
+   }
+   return id;
+}
+
+/**
+ * Переносит таблицу выбора предложения (`rf_dispatch_slot()`) в `dispatch`
+ * того же размера после `refal_vm_compact()`. Положение элемента зависит от
+ * значения литерала, а значения идентификаторов — ссылки на ячейки.
+ */
+static inline
+void rf_dispatch_relocate(
+      struct refal_vm      *vm,
+      struct rf_dispatch   *dispatch,
+      const rf_index       *map,
+      rf_index             size)
+{
+   struct rf_dispatch *old = vm->dispatch;
+   memset(dispatch, 0, vm->dispatch_size * sizeof(*dispatch));
+   vm->dispatch = dispatch;
+   for (rf_index i = 0; i != vm->dispatch_size; ++i) {
+      struct rf_dispatch d = old[i];
+      if (!d.run)
+         continue;
+      if (d.op == rf_identifier) {
+         rf_value v = { .data = d.data };
+         v.id = rf_relocate_id(map, size, v.id);
+         d.data = v.data;
+      }
+      *rf_dispatch_slot(vm, d.run, d.op, d.data) = d;
+   }
+   refal_free(old, vm->dispatch_size * sizeof(*old));
+}
+
+/**
+ * Упорядочивает ячейки РЕФАЛ-машины.
+ *
+ * После продолжительного исполнения освобождаемые (`rf_free_evar()`) и заново
+ * распределяемые ячейки оказываются перемешаны, и обход списка обращается
+ * к памяти в случайном порядке. Занятые ячейки (программа, поле зрения и
+ * формируемые результаты — все предшествующие `vm->free`) переставляются
+ * на месте так, чтобы следовать в порядке обхода списка, с коррекцией ссылок
+ * в структурных скобках, предложениях и идентификаторах. Освобождённые ячейки
+ * после `vm->free` отбрасываются: список далее достраивается заново, а массив,
+ * если занятые ячейки составляют менее четверти, сокращается вдвое (возможно,
+ * неоднократно), возвращая память системе после пиковой нагрузки. Начальный
+ * адрес массива при этом не изменяется (см. ключ +r).
+ *
+ * Индексы, хранимые вне массива (таблица символов, состояние исполнителя),
+ * корректирует вызывающая сторона посредством `rf_relocate()`. Индекс 0 и
+ * индексы освобождённых ячеек заменяются нулём.
+ *
+ * Помимо массива ячеек требуется память под таблицу соответствия,
+ * признаки перенесённых ячеек (по биту на ячейку) и копию таблицы выбора
+ * предложения (`rf_dispatch_relocate()`).
+ *
+ * \result таблица соответствия прежних индексов новым размером `vm->size`
+ *         до вызова (освобождается вызывающей стороной `refal_free()`) либо NULL при
+ *         нехватке памяти (содержимое при этом не изменяется).
+ */
+static inline
+rf_index *refal_vm_compact(
+      struct refal_vm   *vm)
+{
+   assert(vm);
+   assert(vm->u);
+   assert(vm->free);
+   const rf_index size = vm->size;
+   rf_index *map = refal_malloc(size * sizeof(*map));
+   unsigned char *moved = map ? refal_malloc(size / 8 + 1) : NULL;
+   struct rf_dispatch *dispatch = moved && vm->dispatch
+                                ? refal_malloc(vm->dispatch_size * sizeof(*dispatch)) : NULL;
+   if (!moved || (vm->dispatch && !dispatch)) {
+      if (moved)
+         refal_free(moved, size / 8 + 1);
+      if (map)
+         refal_free(map, size * sizeof(*map));
+      return NULL;
+   }
+   memset(map, 0, size * sizeof(*map));
+   memset(moved, 0, size / 8 + 1);
+   rf_index n = 0;
+   for (rf_index i = 1; ; i = vm->u[i].next) {
+      map[i] = ++n;
+      if (i == vm->free)
+         break;
+   }
+   // Исполняемый код предшествует прочим ячейкам и не перемещается, но
+   // ссылается на ящики, следующие за ним.
+   for (rf_index i = 1; i <= vm->code; ++i)
+      assert(map[i] == i);
+   if (vm->code)
+      refal_vm_unprotect_code(vm);
+   // Ячейка переносится на новое место, а занимавшая его и ещё не
+   // перенесённая — следом за ней, пока цепочка не завершится на месте
+   // освобождённой либо уже перенесённой ячейки.
+   for (rf_index i = 1; i != size; ++i) {
+      if (!map[i] || moved[i / 8] & 1 << i % 8)
+         continue;
+      rf_cell c = vm->u[i];
+      rf_value val = RF_VALUE(vm, i);
+      for (rf_index src = i; ; ) {
+         const rf_index k = map[src];
+         moved[src / 8] |= 1 << src % 8;
+         const int carry = map[k] && !(moved[k / 8] & 1 << k % 8);
+         const rf_cell next_c = vm->u[k];
+         const rf_value next_val = RF_VALUE(vm, k);
+         c.prev = k - 1;
+         c.next = k + 1;
+         switch (c.op) {
+         // Свёртка терма в скобках (`rf_bracket_hash()`) учитывает ссылки
+         // идентификаторов, потому сбрасывается.
+         case rf_opening_bracket: case rf_closing_bracket:
+         case rf_sentence:
+            val.data = rf_relocate(map, size, val.link);
+            break;
+         case rf_identifier: case rf_execute:
+            val.id = rf_relocate_id(map, size, val.id);
+            break;
+         default:
+            break;
+         }
+#if REFAL_CELL_SOA
+         vm->v[k] = val;
+#else
+         c.v = val;
+#endif
+         vm->u[k] = c;
+         if (!carry)
+            break;
+         c = next_c;
+         val = next_val;
+         src = k;
+      }
+   }
+   refal_free(moved, size / 8 + 1);
+   if (dispatch)
+      rf_dispatch_relocate(vm, dispatch, map, size);
+   rf_index new_size = size;
+   while (new_size / 4 > n + 2)
+      new_size /= 2;
+   if (new_size != size)
+      refal_vm_resize(vm, new_size);
+   // Завершаем список. Распределение ячеек полагает, что за ним
+   // массив не инициализирован (заполнен нулями).
+   memset(&vm->u[n + 1], 0, (vm->size - n - 1) * sizeof(*vm->u));
+   vm->u[n + 1].prev = n;
+   vm->tail = n + 1;
+   vm->free = n;
+   vm->fragments = 0;
+   // Множества ящиков ссылаются на заголовки и идентификаторы по индексам.
+   rf_charset_clear(vm);
+   if (vm->code)
+      refal_vm_protect_code(vm);
+   return map;
+}
+
 /**
  * Освобождает занятую РЕФАЛ-машиной память.
  */
@@ -376,6 +1100,29 @@ void refal_vm_free(
    // TODO освободить ресурсы, ссылки на которые могут храниться в ячейках.
    refal_free(vm->u, vm->size * sizeof(rf_cell));
    vm->u = 0;
+   if (vm->dispatch)
+      refal_free(vm->dispatch, vm->dispatch_size * sizeof(*vm->dispatch));
+   vm->dispatch = NULL;
+   vm->dispatch_size = 0;
+   if (vm->charset)
+      refal_free(vm->charset, vm->charset_size * sizeof(*vm->charset));
+   vm->charset = NULL;
+   vm->charset_size = 0;
+   vm->charsets = 0;
+#if REFAL_CELL_COMPACT
+   if (vm->wide) {
+      refal_free(vm->wide, vm->wide_size * sizeof(*vm->wide));
+      refal_free(vm->wide_hash, 2 * vm->wide_size * sizeof(*vm->wide_hash));
+   }
+   vm->wide = NULL;
+   vm->wide_hash = NULL;
+   vm->wide_size = 0;
+   vm->wides = 0;
+#endif
+#if REFAL_CELL_SOA
+   refal_free(vm->v, vm->size * sizeof(rf_value));
+   vm->v = 0;
+#endif
    vm->size = 0;
    vm->free = 0;
 }
@@ -429,10 +1176,11 @@ void rf_vm_stats(
          break;
       i = vm->u[i].prev;
    }
-   printf("В поле зрения %u элементов. Активное подвыражение (%u %u). "
-          "Освобождено: %u(%u). Не инициализировано: %u. Всего: %u\n",
-          view_count, prev, next, forward_count, backward_count,
-          vm->size - ununitialized, vm->size);
+   printf("В поле зрения %lu элементов. Активное подвыражение (%lu %lu). "
+          "Освобождено: %lu(%lu). Не инициализировано: %lu. Всего: %lu\n",
+          (unsigned long)view_count, (unsigned long)prev, (unsigned long)next,
+          (unsigned long)forward_count, (unsigned long)backward_count,
+          (unsigned long)(vm->size - ununitialized), (unsigned long)vm->size);
 #endif
 }
 
@@ -457,11 +1205,56 @@ void rf_vm_stats(
  * удалять элементы на границах диапазона без сдвига `prev` и `next`.
  */
 
+#ifndef REFAL_PREFETCH
+#define REFAL_PREFETCH 1
+#endif
+
+/**
+ * Запрашивает загрузку в кеш ячейки, следующей за `i`, пока обрабатывается
+ * текущая (при обходе списка в циклах сопоставления, копирования и вывода).
+ * Отключается при сборке с `REFAL_PREFETCH=0`.
+ */
+static inline
+void rf_prefetch_next(
+      const struct refal_vm   *vm,
+      rf_index                i)
+{
+#if REFAL_PREFETCH
+   __builtin_prefetch(&vm->u[vm->u[i].next]);
+#else
+   (void)vm;
+   (void)i;
+#endif
+}
+
+/**
+ * Политика повторного использования освобождённых ячеек.
+ *
+ * `REFAL_FREE_LIFO` — освобождённые ячейки используются первыми.
+ * `REFAL_FREE_NEAR` — первыми используются лишь освобождённые поблизости
+ * (в пределах `REFAL_FREE_NEAR_WINDOW` ячеек) от места размещения данных,
+ * удалённые — после прочих свободных. Последовательно размещаемые ячейки
+ * результата при этом чаще оказываются смежными в памяти.
+ *
+ * Задаётся при сборке, например `make DEFINES=-DREFAL_FREE_POLICY=1`.
+ */
+#define REFAL_FREE_LIFO 0
+#define REFAL_FREE_NEAR 1
+
+#ifndef REFAL_FREE_POLICY
+#define REFAL_FREE_POLICY REFAL_FREE_LIFO
+#endif
+
+#ifndef REFAL_FREE_NEAR_WINDOW
+#define REFAL_FREE_NEAR_WINDOW 256
+#endif
+
 /**
  * Перемещает ячейки (prev ... next) в свободную часть списка.
  * Передаваемые аргументами границы используются в вызывающем коде для адресации
  * смежных областей, и, для упрощения реализации, требуют неизменности. Поэтому
- * переносятся после `vm->free` (что может показаться не всегда оптимальным).
+ * переносятся после `vm->free` (что может показаться не всегда оптимальным),
+ * либо, см. `REFAL_FREE_POLICY`, в конец списка свободных.
  */
 static inline
 void rf_free_evar(
@@ -478,15 +1271,21 @@ void rf_free_evar(
       vm->u[prev].next = next;
       vm->u[next].prev = prev;
       // Добавить ячейки после vm->free.
-      const rf_index heap = vm->u[vm->free].next;
-      vm->u[vm->free].next = first;
-      vm->u[vm->free].mode = rf_op_default;
-      vm->u[first].prev = vm->free;
+      rf_index at = vm->free;
+#if REFAL_FREE_POLICY == REFAL_FREE_NEAR
+      if ((first > at ? first - at : at - first) > REFAL_FREE_NEAR_WINDOW)
+         at = vm->u[vm->tail].prev;
+#endif
+      const rf_index heap = vm->u[at].next;
+      vm->u[at].next = first;
+      vm->u[at].mode = rf_op_default;
+      vm->u[first].prev = at;
       vm->u[first].op  = rf_undefined;
       vm->u[last].next = heap;
       vm->u[last].mode = rf_op_default;
       vm->u[heap].prev = last;
       vm->u[heap].op   = rf_undefined;
+      ++vm->fragments;
       // TODO закрыть описатели (handle), при наличии.
    }
 }
@@ -560,17 +1359,118 @@ rf_index rf_alloc_evar_move(
    return first;
 }
 
+#if REFAL_CELL_COMPACT
+/// Первое значение ячейки, хранящее индекс в таблице `wide` РЕФАЛ-машины.
+/// Макроцифры от `INT32_MIN + RF_WIDE_MAX` до `INT32_MAX` хранятся в ячейке.
+#define RF_WIDE_BASE ((uint32_t)INT32_MIN)
+/// Наибольшее количество макроцифр, хранимых вне ячеек.
+#define RF_WIDE_MAX  ((rf_index)1 << RF_INDEX_BITS)
+
+/**
+ * Размещает макроцифру в таблице `wide` (если её там нет).
+ * Равные макроцифры получают один индекс, что позволяет сравнивать их
+ * по значению ячейки.
+ * \result индекс либо `RF_WIDE_MAX`, если таблица заполнена или
+ *         недостаточно памяти.
+ */
+static inline
+rf_index rf_wide_intern(
+      struct refal_vm   *vm,
+      rf_int            num)
+{
+   if (vm->wides == vm->wide_size) {
+      if (vm->wide_size == RF_WIDE_MAX)
+         return RF_WIDE_MAX;
+      const rf_index size = vm->wide_size ? 2 * vm->wide_size : 16;
+      rf_index *hash = refal_malloc(2 * size * sizeof(*hash));
+      if (!hash)
+         return RF_WIDE_MAX;
+      rf_int *wide = vm->wide
+                   ? refal_realloc(vm->wide, vm->wide_size * sizeof(*wide), size * sizeof(*wide))
+                   : refal_malloc(size * sizeof(*wide));
+      if (!wide) {
+         refal_free(hash, 2 * size * sizeof(*hash));
+         return RF_WIDE_MAX;
+      }
+      vm->wide = wide;
+      memset(hash, 0, 2 * size * sizeof(*hash));
+      for (rf_index i = 0; i != vm->wides; ++i) {
+         rf_index k = (uint64_t)wide[i] * 0x9e3779b97f4a7c15u >> 32 & (2 * size - 1);
+         while (hash[k])
+            k = (k + 1) & (2 * size - 1);
+         hash[k] = i + 1;
+      }
+      if (vm->wide_hash)
+         refal_free(vm->wide_hash, 2 * vm->wide_size * sizeof(*hash));
+      vm->wide_hash = hash;
+      vm->wide_size = size;
+   }
+   const rf_index mask = 2 * vm->wide_size - 1;
+   rf_index k = (uint64_t)num * 0x9e3779b97f4a7c15u >> 32 & mask;
+   for (; vm->wide_hash[k]; k = (k + 1) & mask) {
+      if (vm->wide[vm->wide_hash[k] - 1] == num)
+         return vm->wide_hash[k] - 1;
+   }
+   vm->wide[vm->wides] = num;
+   vm->wide_hash[k] = ++vm->wides;
+   return vm->wides - 1;
+}
+#endif
+
+/**
+ * Преобразует макроцифру в значение ячейки.
+ * \result 0, если макроцифру невозможно разместить (`REFAL_CELL_COMPACT`).
+ */
+static inline
+int rf_num_data(
+      struct refal_vm   *vm,
+      rf_int            num,
+      rf_data           *data)
+{
+#if REFAL_CELL_COMPACT
+   if (num >= (rf_int)INT32_MIN + RF_WIDE_MAX && num <= INT32_MAX) {
+      *data = (uint32_t)(int32_t)num;
+      return 1;
+   }
+   const rf_index i = rf_wide_intern(vm, num);
+   *data = RF_WIDE_BASE + i;
+   return i != RF_WIDE_MAX;
+#else
+   (void)vm;
+   *data = num;
+   return 1;
+#endif
+}
+
+/**
+ * Возвращает макроцифру, хранимую в ячейке `i`.
+ */
+static inline
+rf_int rf_num(
+      const struct refal_vm   *vm,
+      rf_index                i)
+{
+#if REFAL_CELL_COMPACT
+   const rf_data data = RF_VALUE(vm, i).data;
+   if (data - RF_WIDE_BASE < RF_WIDE_MAX)
+      return vm->wide[data - RF_WIDE_BASE];
+   return (int32_t)data;
+#else
+   return RF_VALUE(vm, i).num;
+#endif
+}
+
 /**
  * Добавляет в свободную часть списка значение и возвращает номер ячейки.
  */
 static inline
 rf_index rf_alloc_value(
       struct refal_vm   *vm,
-      uint64_t          value,
+      rf_data           value,
       rf_opcode         tag)
 {
    rf_index i = refal_vm_alloc_1(vm);
-   vm->u[i].data = value;
+   RF_VALUE(vm, i).data = value;
    vm->u[i].op   = tag;
    return i;
 }
@@ -601,13 +1501,17 @@ rf_index rf_alloc_char(
 
 /**
  * Добавляет в свободную часть списка целое число и возвращает номер ячейки.
+ * \result 0, если число невозможно разместить (см. `rf_num_data()`).
  */
 static inline
 rf_index rf_alloc_int(
       struct refal_vm   *vm,
       rf_int            num)
 {
-   return rf_alloc_value(vm, num, rf_number);
+   rf_data data;
+   if (!rf_num_data(vm, num, &data))
+      return 0;
+   return rf_alloc_value(vm, data, rf_number);
 }
 
 /**
@@ -619,8 +1523,8 @@ void rf_assign_id(
       rf_index          i,
       struct rf_id      id)
 {
-   vm->u[i].data = 0;
-   vm->u[i].id = id;
+   RF_VALUE(vm, i).data = 0;
+   RF_VALUE(vm, i).id = id;
 }
 
 /**
@@ -632,10 +1536,44 @@ rf_index rf_alloc_identifier(
       struct rf_id      id)
 {
    rf_index i = rf_alloc_value(vm, 0, rf_identifier);
-   vm->u[i].id = id;
+   RF_VALUE(vm, i).id = id;
    return i;
 }
 
+/**
+ * Разбирает начальный октет последовательности UTF-8.
+ * \retval tail количество последующих октетов символа.
+ * \result значащие разряды символа, содержащиеся в начальном октете.
+ */
+static inline
+wchar_t rf_utf8_lead(
+      unsigned char     octet,
+      unsigned          *tail)
+{
+   switch (octet) {
+   // ASCII
+   case 0x00 ... 0x7f:
+      *tail = 0;
+      return octet;
+   // 2 байта на символ.
+   case 0xc0 ... 0xdf:
+      *tail = 1;
+      return 0x1f & octet;
+   // 3 байта на символ.
+   case 0xe0 ... 0xef:
+      *tail = 2;
+      return 0x0f & octet;
+   // 4 байта на символ.
+   case 0xf0 ... 0xf4:
+      *tail = 3;
+      return 0x03 & octet;
+   default:
+      assert(0);
+      *tail = 0;
+      return 0;
+   }
+}
+
 /**
  * Добавляет в свободную часть списка символ, получаемый из последовательности
  * UTF-8. Если текущий октет представляет часть последовательности, происходит
@@ -655,31 +1593,8 @@ rf_index rf_alloc_char_decode_utf8(
    case 0:
       i = refal_vm_alloc_1(vm);
       vm->u[i].op  = rf_char;
-      switch (octet) {
-      // ASCII
-      case 0x00 ... 0x7f:
-         vm->u[i].data = octet;
-         return i;
-      // 2 байта на символ.
-      case 0xc0 ... 0xdf:
-         *state = 1;
-         vm->u[i].data = 0x1f & octet;
-         return i;
-      // 3 байта на символ.
-      case 0xe0 ... 0xef:
-         *state = 2;
-         vm->u[i].data = 0x0f & octet;
-         return i;
-      // 4 байта на символ.
-      case 0xf0 ... 0xf4:
-         *state = 3;
-         vm->u[i].data = 0x03 & octet;
-         return i;
-      default:
-         assert(0);
-         vm->u[i].data = 0;
-         return i;
-      }
+      RF_VALUE(vm, i).data = rf_utf8_lead(octet, state);
+      return i;
    default:
       assert(0);
    case 1:
@@ -688,7 +1603,7 @@ rf_index rf_alloc_char_decode_utf8(
       i = vm->u[vm->free].prev;
       assert(vm->u[i].op == rf_char);
       --*state;
-      vm->u[i].data = (vm->u[i].chr << 6) | (0x3f & octet);
+      RF_VALUE(vm, i).data = (RF_VALUE(vm, i).chr << 6) | (0x3f & octet);
       return i;
    }
 }
@@ -703,7 +1618,7 @@ unsigned rf_encode_utf8(
       rf_index                s,
       char                    ptr[4])
 {
-   wchar_t chr = vm->u[s].chr;
+   wchar_t chr = RF_VALUE(vm, s).chr;
    unsigned size = 0;
    if (chr < 0x80) {
       ptr[0] = chr;
@@ -727,6 +1642,53 @@ unsigned rf_encode_utf8(
    return size;
 }
 
+/**
+ * Размещает в свободной памяти символы из буфера с последовательностью UTF-8.
+ * В отличие от посимвольного `rf_alloc_char_decode_utf8()`, предварительно
+ * подсчитывает количество символов и распределяет ячейки одним вызовом
+ * `refal_vm_alloc_n()`. Состояние декодера совместимо с
+ * `rf_alloc_char_decode_utf8()`: незавершённый в конце буфера символ
+ * дополняется при следующем вызове.
+ * \result Номер ячейки первого начатого в буфере символа (`vm->free`, если
+ *         таковых нет) или 0 при нехватке памяти.
+ */
+static inline
+rf_index rf_alloc_utf8(
+      struct refal_vm   *vm,
+      const char        *str,    ///< последовательность UTF-8.
+      size_t            size,    ///< длина последовательности в октетах.
+      unsigned          *state)  ///< состояние декодера. 0 при первом вызове.
+{
+   const unsigned char *s = (const unsigned char *)str;
+   const unsigned char *const end = s + size;
+   // Завершаем символ, начатый в предыдущем буфере.
+   for (; *state && s != end; ++s)
+      rf_alloc_char_decode_utf8(vm, *s, state);
+   rf_index n = 0;
+   for (const unsigned char *p = s; p != end; ) {
+      unsigned tail;
+      rf_utf8_lead(*p++, &tail);
+      ++n;
+      for (; tail && p != end; --tail)
+         ++p;
+   }
+   if (!n)
+      return vm->free;
+   const rf_index r = refal_vm_alloc_n(vm, n);
+   if (!r)
+      return 0;
+   rf_index i = r;
+   while (s != end) {
+      vm->u[i].op = rf_char;
+      RF_VALUE(vm, i).data = rf_utf8_lead(*s++, state);
+      for (; *state && s != end; --*state, ++s)
+         RF_VALUE(vm, i).data = (RF_VALUE(vm, i).chr << 6) | (0x3f & *s);
+      i = vm->u[i].next;
+   }
+   assert(i == vm->free);
+   return r;
+}
+
 /**
  * Размещает в свободной памяти строку.
  * \result Номер содержащей первый символ строки ячейки.
@@ -737,13 +1699,8 @@ rf_index rf_alloc_string(
       const char        *str)
 {
    assert(str);
-   rf_index r = vm->free;
    unsigned state = 0;
-   char c;
-   while ((c = *str++)) {
-      rf_alloc_char_decode_utf8(vm, (unsigned char)c, &state);
-   }
-   return r;
+   return rf_alloc_utf8(vm, str, strlen(str), &state);
 }
 
 /**
@@ -757,8 +1714,152 @@ void rf_link_brackets(
 {
    assert(vm->u[opening].op == rf_opening_bracket);
    assert(vm->u[closing].op == rf_closing_bracket);
-   vm->u[opening].data = closing;
-   vm->u[closing].data = opening;
+   RF_VALUE(vm, opening).data = closing;
+   RF_VALUE(vm, closing).data = opening;
+}
+
+/**
+ * Свёртка терма в скобках, хранимая в открывающей скобке (0 — не вычислена,
+ * либо `REFAL_BRACKET_HASH` отключено).
+ * Новая пара скобок (`rf_link_brackets()`) свёртки не имеет. Изменяющие
+ * ячейки на месте (`Ord`, `Chr`) сбрасывают свёртки всех скобок в аргументе
+ * (`rf_bracket_hash_assign()` с нулём). Свёртка учитывает ссылки
+ * идентификаторов на ячейки, потому сбрасывается и при упорядочивании ячеек
+ * (`refal_vm_compact()`).
+ */
+static inline
+uint32_t rf_bracket_hash(
+      const struct refal_vm   *vm,
+      rf_index                opening)
+{
+   assert(vm->u[opening].op == rf_opening_bracket);
+#if REFAL_BRACKET_HASH
+   return RF_VALUE(vm, opening).data >> 32;
+#else
+   (void)vm;
+   return 0;
+#endif
+}
+
+/**
+ * Сохраняет свёртку терма в открывающей скобке (например, у копии терма).
+ */
+static inline
+void rf_bracket_hash_assign(
+      struct refal_vm   *vm,
+      rf_index          opening,
+      uint32_t          hash)
+{
+   assert(vm->u[opening].op == rf_opening_bracket);
+#if REFAL_BRACKET_HASH
+   RF_VALUE(vm, opening).data = (rf_data)hash << 32 | RF_VALUE(vm, opening).link;
+#else
+   (void)vm; (void)hash;
+#endif
+}
+
+/**
+ * Вычисляет (однократно) свёртку терма в скобках по тегам и значениям всех
+ * вложенных ячеек. Для равных термов свёртки равны; обратное не гарантировано.
+ */
+static inline
+uint32_t rf_bracket_hash_eval(
+      struct refal_vm   *vm,
+      rf_index          opening)
+{
+   uint32_t hash = rf_bracket_hash(vm, opening);
+   if (hash || !REFAL_BRACKET_HASH)
+      return hash;
+   const rf_index closing = RF_VALUE(vm, opening).link;
+   uint64_t h = 0xcbf29ce484222325;
+   for (rf_index i = vm->u[opening].next; i != closing; i = vm->u[i].next) {
+      rf_opcode op = vm->u[i].op;
+      rf_data d = op == rf_opening_bracket || op == rf_closing_bracket ? 0 : RF_VALUE(vm, i).data;
+      h = (h ^ (d << 4 | op)) * 0x100000001b3;
+   }
+   hash = (uint32_t)(h ^ h >> 32);
+   hash += !hash;
+   rf_bracket_hash_assign(vm, opening, hash);
+   return hash;
+}
+
+/**
+ * Добавляет в свободную часть списка копию диапазона от `first` до `last`
+ * включительно (скобки в нём парные). Иначе говоря, копирует e-переменную
+ * в пространство формирования результата.
+ *
+ * Если исходные ячейки размещены подряд и далее свободной ячейки начинается
+ * не инициализированная часть массива, ячейки копии распределяются за одну
+ * операцию (`refal_vm_alloc_n()`) и копируются блоком, а ссылки скобок
+ * смещаются. Иначе ячейки распределяются по одной, и пары скобок копии
+ * связываются по мере обхода; стек незакрытых скобок хранится в значениях
+ * их же копий. Свёртки термов в скобках (`rf_bracket_hash()`) копируются.
+ *
+ * \result номер начальной ячейки копии либо 0, если память исчерпана.
+ */
+static inline
+rf_index rf_alloc_evar_copy(
+      struct refal_vm   *vm,
+      rf_index          first,
+      rf_index          last)
+{
+   const rf_index t = vm->u[vm->free].next;
+   if (t == vm->free + 1 && !vm->u[t].next) {
+      rf_index n = 1;
+      rf_index i = first;
+      for (; i != last && vm->u[i].next == i + 1; ++i)
+         ++n;
+      if (i == last) {
+         const rf_index d = refal_vm_alloc_n(vm, n);
+         if (!d)
+            return 0;
+         assert(vm->free == d + n);
+         const rf_index prev = vm->u[d].prev;
+         memcpy(&vm->u[d], &vm->u[first], n * sizeof(*vm->u));
+#if REFAL_CELL_SOA
+         memcpy(&vm->v[d], &vm->v[first], n * sizeof(*vm->v));
+#endif
+         for (i = d; i != d + n; ++i) {
+            vm->u[i].prev = i - 1;
+            vm->u[i].next = i + 1;
+            if (vm->u[i].op == rf_opening_bracket || vm->u[i].op == rf_closing_bracket)
+               RF_VALUE(vm, i).link = RF_VALUE(vm, i).link - first + d;
+         }
+         vm->u[d].prev = prev;
+         return d;
+      }
+   }
+   rf_index d = 0;
+   rf_index open = 0;
+   for (rf_index s = first; ; s = vm->u[s].next) {
+      rf_prefetch_next(vm, s);
+      const rf_index i = refal_vm_alloc_1(vm);
+      if (!i)
+         return 0;
+      if (!d)
+         d = i;
+      const rf_opcode op = vm->u[s].op;
+      vm->u[i].op = op;
+      switch (op) {
+      case rf_opening_bracket:
+         RF_VALUE(vm, i).data = open;
+         open = i;
+         break;
+      case rf_closing_bracket: {
+         const rf_index o = open;
+         open = RF_VALUE(vm, o).link;
+         rf_link_brackets(vm, o, i);
+         rf_bracket_hash_assign(vm, o, rf_bracket_hash(vm, RF_VALUE(vm, s).link));
+         break;
+      }
+      default:
+         RF_VALUE(vm, i).data = RF_VALUE(vm, s).data;
+      }
+      if (s == last)
+         break;
+   }
+   assert(!open);
+   return d;
 }
 
 /**
@@ -773,6 +1874,16 @@ rf_index rf_alloc_strv(
 {
    assert(strv);
    rf_index r = vm->free;
+   // Ячейки (по одной на октет с запасом) распределяются и связываются
+   // заранее, затем возвращаются в свободные для последовательного заполнения.
+   size_t n = 0;
+   for (int i = 0; i < strc; ++i)
+      n += 2 + strlen(strv[i]);
+   if (n) {
+      if (!refal_vm_alloc_n(vm, n))
+         return 0;
+      vm->free = r;
+   }
    for (int i = 0; i < strc; ++i) {
       rf_index ob = rf_alloc_command(vm, rf_opening_bracket);
       rf_alloc_string(vm, strv[i]);
@@ -807,7 +1918,7 @@ int rf_svar_equal(
    // Сначала сравниваем данные, поскольку:
    // 1. даже при равенстве тегов, они вероятно, различаются;
    // 2. теги хранятся в битовом поле и требуют команды AND для выделения.
-   return vm->u[s1].data == vm->u[s2].data
+   return RF_VALUE(vm, s1).data == RF_VALUE(vm, s2).data
        && vm->u[s1].op   == vm->u[s2].op;
 }
 
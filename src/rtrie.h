@@ -8,6 +8,10 @@
  * Идентификаторы (имена функциональных определений) хранятся в виде
  * префиксного тернарного дерева. Структура заполнятся при чтении исходного
  * текста постепенно, по одному символу.
+ *
+ * По окончании трансляции имена дополнительно размещаются в хеш-таблице
+ * (`rtrie_hash_names()`), по которой исполнитель находит имя, заданное
+ * строкой, целиком, без посимвольного спуска по дереву.
  * \{
  */
 
@@ -15,7 +19,9 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wchar.h>
 
 #include "refal.h"
@@ -27,6 +33,7 @@
 typedef int rtrie_index;
 
 struct rtrie_node;
+struct rtrie_name;
 
 /**
  * Описатель префиксного дерева.
@@ -35,9 +42,14 @@ struct refal_trie {
    struct rtrie_node *n;   ///< Массив узлов.
    rtrie_index size;       ///< Текущий размер.
    rtrie_index free;       ///< Первый свободный элемент.
+
+   struct rtrie_name *h;   ///< Хеш-таблица имён (`rtrie_hash_names()`).
+   unsigned    hsize;      ///< Размер таблицы (степень 2), 0 — не построена.
+   wchar_t     *names;     ///< Символы имён таблицы.
+   size_t      names_size;
 };
 
-static_assert(sizeof(struct rf_id) == sizeof(uint32_t), "размеры должны соответствовать");
+static_assert(sizeof(struct rf_id) == sizeof(rf_index), "размеры должны соответствовать");
 
 /**
  * Узел.
@@ -53,6 +65,16 @@ struct rtrie_node {
    struct rf_id val;       ///< Соответствующее префиксу значение.
 };
 
+/**
+ * Элемент хеш-таблицы имён.
+ */
+struct rtrie_name {
+   uint32_t    hash;       ///< Свёртка имени (`rtrie_hash_step()`).
+   uint32_t    len;        ///< Длина имени, 0 — элемент свободен.
+   size_t      name;       ///< Первый символ имени в `refal_trie.names`.
+   rtrie_index node;       ///< Узел последнего символа имени.
+};
+
 /**
  * Резервирует память для хранения внутреннего представления РЕФАЛ программы.
  * \result Ненулевое значение в случае успеха.
@@ -65,6 +87,10 @@ void *rtrie_alloc(
    rt->n = refal_malloc(size * sizeof(struct rtrie_node));
    rt->size = rt->n ? size : 0;
    rt->free = 0;
+   rt->h = NULL;
+   rt->hsize = 0;
+   rt->names = NULL;
+   rt->names_size = 0;
    return rt->n;
 }
 
@@ -96,6 +122,14 @@ void rtrie_free(
    rtrie->n = 0;
    rtrie->size = 0;
    rtrie->free = 0;
+   if (rtrie->h)
+      refal_free(rtrie->h, rtrie->hsize * sizeof(struct rtrie_name));
+   if (rtrie->names)
+      refal_free(rtrie->names, rtrie->names_size * sizeof(wchar_t));
+   rtrie->h = NULL;
+   rtrie->hsize = 0;
+   rtrie->names = NULL;
+   rtrie->names_size = 0;
 }
 
 /**
@@ -123,6 +157,26 @@ rtrie_index rtrie_new_node(
    return node;
 }
 
+/**
+ * Возвращает системе не занятую часть массива узлов (по окончании трансляции).
+ */
+static inline
+void rtrie_shrink(
+      struct refal_trie *rt)
+{
+   assert(rt);
+   // Нулевой размер не позволит увеличить массив вновь.
+   rtrie_index size = rt->free ? rt->free : 1;
+   if (rt->n && size < rt->size) {
+      void *p = refal_realloc(rt->n, rt->size * sizeof(struct rtrie_node),
+                              size * sizeof(struct rtrie_node));
+      if (p) {
+         rt->n = p;
+         rt->size = size;
+      }
+   }
+}
+
 /**
  * Находит (добавляя при отсутствии) узел символа \c chr, начиная поиск с \c idx.
  * \result Индекс узла.
@@ -327,6 +381,241 @@ struct rf_id rtrie_get_value(
    }
 }
 
+/**
+ * Ищет в дереве имя, заданное последовательностью символов поля зрения
+ * от ячейки `s` до первой отличной от rf_char (либо `next`).
+ * Пробел может следовать после имени модуля и вызывает поиск в отдельном
+ * пространстве имён: следующий символ ищется среди соседей пробела.
+ * \result Индекс узла либо -1 в случае отсутствия.
+ */
+static inline
+rtrie_index rtrie_find_run(
+      const struct refal_trie *rt,
+      const struct refal_vm   *vm,
+      rf_index                s,
+      rf_index                next,
+      rf_index                *end)    ///< Ячейка, следующая за строкой.
+{
+   rtrie_index idx = rtrie_find_first(rt, RF_VALUE(vm, s).chr);
+   wchar_t pc = L'\0';
+   for (s = vm->u[s].next; s != next && vm->u[s].op == rf_char; s = vm->u[s].next) {
+      rf_prefetch_next(vm, s);
+      if (!(idx < 0)) {
+         idx = pc == L' ' ? rtrie_find_at(rt, idx, RF_VALUE(vm, s).chr)
+                          : rtrie_find_next(rt, idx, RF_VALUE(vm, s).chr);
+         pc = RF_VALUE(vm, s).chr;
+      }
+   }
+   *end = s;
+   return idx;
+}
+
+/**
+ * Добавляет к свёртке имени очередной символ (FNV-1a).
+ */
+static inline
+uint64_t rtrie_hash_step(
+      uint64_t h,
+      wchar_t  chr)
+{
+   return (h ^ (uint32_t)chr) * 0x100000001b3;
+}
+
+/// Начальное значение свёртки имени.
+#define RTRIE_HASH_BASIS 0xcbf29ce484222325
+
+/**
+ * Ищет в хеш-таблице имя, заданное последовательностью символов поля зрения
+ * (как `rtrie_find_run()`). Повторные пробелы внутри имени, как и при спуске
+ * по дереву, равнозначны одному.
+ * \result Индекс узла либо -1, если имени в таблице нет.
+ */
+static inline
+rtrie_index rtrie_hash_find_run(
+      const struct refal_trie *rt,
+      const struct refal_vm   *vm,
+      rf_index                s,
+      rf_index                next,
+      rf_index                *end)    ///< Ячейка, следующая за строкой.
+{
+   if (!rt->hsize)
+      return -1;
+   uint64_t h = RTRIE_HASH_BASIS;
+   uint32_t len = 0;
+   wchar_t pc = L'\0';
+   rf_index i = s;
+   for (unsigned k = 0; i != next && vm->u[i].op == rf_char; i = vm->u[i].next, ++k) {
+      rf_prefetch_next(vm, i);
+      const wchar_t c = RF_VALUE(vm, i).chr;
+      if (!(c == L' ' && pc == L' ' && k > 1)) {
+         h = rtrie_hash_step(h, c);
+         ++len;
+      }
+      pc = c;
+   }
+   *end = i;
+   for (unsigned k = (uint32_t)h & (rt->hsize - 1); rt->h[k].len; k = (k + 1) & (rt->hsize - 1)) {
+      const struct rtrie_name *e = &rt->h[k];
+      if (e->hash != (uint32_t)h || e->len != len)
+         continue;
+      const wchar_t *name = &rt->names[e->name];
+      pc = L'\0';
+      rf_index j = s;
+      for (unsigned m = 0; j != i; j = vm->u[j].next, ++m) {
+         const wchar_t c = RF_VALUE(vm, j).chr;
+         if (!(c == L' ' && pc == L' ' && m > 1) && *name++ != c)
+            break;
+         pc = c;
+      }
+      if (j == i)
+         return e->node;
+   }
+   return -1;
+}
+
+/**\cond
+ * Узел, достигнутый при обходе дерева (`rtrie_hash_names()`).
+ */
+struct rtrie_names_item {
+   rtrie_index node;
+   unsigned    parent;  ///< Предыдущий символ имени (UINT_MAX — нет).
+   unsigned    len;     ///< Длина имени.
+   int         space;   ///< Символу предшествует пробел.
+};
+
+/**
+ * Состояние обхода дерева в ширину.
+ */
+struct rtrie_names_walk {
+   struct refal_trie       *rt;
+   struct rtrie_names_item *q;      ///< Очередь узлов.
+   unsigned                tail;    ///< Конец очереди.
+   unsigned char           *seen;   ///< Узлы, уже помещённые в очередь.
+};
+/**\endcond*/
+
+/**
+ * Помещает в очередь узлы уровня от `x`, следующие за элементом `parent`.
+ * Учитываются лишь узлы, находимые поиском от `from` (`rtrie_find_at()`):
+ * скопированный при импорте модуля узел ссылается на соседей из другого
+ * уровня. Повторный пробел (`from` после пробела) не учитывается.
+ */
+static inline
+void rtrie_names_subtree(
+      struct rtrie_names_walk *w,
+      rtrie_index             x,
+      rtrie_index             from,
+      unsigned                parent,
+      int                     space)
+{
+   const struct rtrie_node *n = &w->rt->n[x];
+   if (n->left)
+      rtrie_names_subtree(w, n->left, from, parent, space);
+   if (!w->seen[x] && !(space && n->chr == L' ')
+    && rtrie_find_at(w->rt, from, n->chr) == x) {
+      w->seen[x] = 1;
+      const unsigned len = parent == UINT_MAX ? 0 : w->q[parent].len;
+      w->q[w->tail++] = (struct rtrie_names_item) { x, parent, len + 1 + space, space };
+   }
+   if (n->right)
+      rtrie_names_subtree(w, n->right, from, parent, space);
+}
+
+/**
+ * Строит хеш-таблицу имён для поиска по строке (`rtrie_find_value_by_tags()`).
+ * Вызывается по окончании трансляции: дерево далее не изменяется.
+ *
+ * Дерево обходится в ширину, так что узел, достижимый несколькими именами
+ * (после импорта модулей дерево содержит общие ветви), получает кратчайшее
+ * из них, а при равной длине — записанное через пробел «Модуль функция».
+ * Прочие имена находятся по дереву. При нехватке памяти таблица
+ * не строится.
+ */
+static inline
+void rtrie_hash_names(
+      struct refal_trie *rt)
+{
+   assert(rt);
+   assert(!rt->hsize);
+   if (!rt->free)
+      return;
+   struct rtrie_names_walk w = { .rt = rt };
+   w.q = refal_malloc(rt->free * sizeof(*w.q));
+   w.seen = refal_malloc(rt->free);
+   wchar_t *name = refal_malloc(2 * (size_t)rt->free * sizeof(*name));
+   if (w.q && w.seen && name) {
+      memset(w.seen, 0, rt->free);
+      rtrie_names_subtree(&w, 0, 0, UINT_MAX, 0);
+      unsigned count = 0;
+      size_t chars = 0;
+      for (unsigned i = 0; i != w.tail; ++i) {
+         const struct rtrie_names_item *e = &w.q[i];
+         const struct rtrie_node *n = &rt->n[e->node];
+         if (n->val.tag != rf_id_undefined) {
+            ++count;
+            chars += e->len;
+         }
+         // За пробелом внутри имени следующий символ ищется среди его
+         // соседей (см. `rtrie_find_run()`).
+         if (n->chr == L' ' && e->len > 1) {
+            continue;
+         } else if (n->next) {
+            if (e->len) {
+               const rtrie_index s = rtrie_find_at(rt, n->next, L' ');
+               if (!(s < 0))
+                  rtrie_names_subtree(&w, s, s, i, 1);
+            }
+            rtrie_names_subtree(&w, n->next, n->next, i, 0);
+         }
+      }
+      unsigned size = 2;
+      while (size < 2 * count)
+         size *= 2;
+      rt->h = refal_malloc(size * sizeof(*rt->h));
+      rt->names = refal_malloc((chars ? chars : 1) * sizeof(*rt->names));
+      if (rt->h && rt->names) {
+         memset(rt->h, 0, size * sizeof(*rt->h));
+         rt->hsize = size;
+         rt->names_size = chars ? chars : 1;
+         chars = 0;
+         for (unsigned i = 0; i != w.tail; ++i) {
+            const struct rtrie_names_item *e = &w.q[i];
+            if (rt->n[e->node].val.tag == rf_id_undefined)
+               continue;
+            // Имя составляется от последнего символа к первому.
+            wchar_t *c = &name[e->len];
+            for (unsigned j = i; j != UINT_MAX; j = w.q[j].parent) {
+               *--c = rt->n[w.q[j].node].chr;
+               if (w.q[j].space)
+                  *--c = L' ';
+            }
+            uint64_t h = RTRIE_HASH_BASIS;
+            for (unsigned j = 0; j != e->len; ++j)
+               h = rtrie_hash_step(h, name[j]);
+            unsigned k = (uint32_t)h & (size - 1);
+            while (rt->h[k].len)
+               k = (k + 1) & (size - 1);
+            rt->h[k] = (struct rtrie_name) { (uint32_t)h, e->len, chars, e->node };
+            wmemcpy(&rt->names[chars], name, e->len);
+            chars += e->len;
+         }
+      } else {
+         if (rt->h)
+            refal_free(rt->h, size * sizeof(*rt->h));
+         if (rt->names)
+            refal_free(rt->names, (chars ? chars : 1) * sizeof(*rt->names));
+         rt->h = NULL;
+         rt->names = NULL;
+      }
+   }
+   if (w.q)
+      refal_free(w.q, rt->free * sizeof(*w.q));
+   if (w.seen)
+      refal_free(w.seen, rt->free);
+   if (name)
+      refal_free(name, 2 * (size_t)rt->free * sizeof(*name));
+}
+
 /**
  * Ищет в поле зрения идентификатор с типом tag1 или tag2
  * и возвращает определяемый им описатель функции,
@@ -353,7 +642,7 @@ struct rf_id rtrie_find_value_by_tags(
       n = vm->u[id].next;
       switch (vm->u[id].op) {
       case rf_identifier:
-         function = vm->u[id].id;
+         function = RF_VALUE(vm, id).id;
          if (function.tag == tag1 || function.tag == tag2) {
 found:      rf_free_evar(vm, vm->u[id].prev, n);
             return function;
@@ -362,29 +651,29 @@ found:      rf_free_evar(vm, vm->u[id].prev, n);
          }
          continue;
       case rf_char: ;
-         // Просматриваем последовательность символов до конца.
-         // Параллельно производится поиск в дереве, если возможен.
-         // Пробел может следовать после имени модуля и вызывает
-         // поиск в отдельном пространство имён.
-         rtrie_index idx = rtrie_find_first(vm->rt, vm->u[id].chr);
-         wchar_t pc = L'\0';
-         for (n = vm->u[id].next ; n != next && vm->u[n].op == rf_char; n = vm->u[n].next)
-            if (!(idx < 0)) {
-               idx = pc == L' ' ? rtrie_find_at(vm->rt, idx, vm->u[n].chr)
-                           : rtrie_find_next(vm->rt, idx, vm->u[n].chr);
-               pc = vm->u[n].chr;
-            }
+         rtrie_index idx = rtrie_hash_find_run(rt, vm, id, next, &n);
+         if (idx < 0) {
+            // Имени нет в хеш-таблице — ищем в дереве
+            // (например, слитное «Модульфункция» либо повторно импортированное).
+            idx = rtrie_find_run(rt, vm, id, next, &n);
+         }
+#ifndef NDEBUG
+         else {
+            rf_index tree_n;
+            assert(idx == rtrie_find_run(rt, vm, id, next, &tree_n) && tree_n == n);
+         }
+#endif
          // Если идентификатор "найден", но неопределён,
          // значит это часть другого. Считаем его обычным текстом.
          // Так же пропускаем и неподходящие.
          if (!(idx < 0)) {
-            function = vm->rt->n[idx].val;
+            function = rt->n[idx].val;
             if (function.tag == tag1 || function.tag == tag2)
                goto found;
          }
          continue;
       case rf_opening_bracket:
-         id = vm->u[id].link;
+         id = RF_VALUE(vm, id).link;
          if (!(id < vm->size)) {
             return (struct rf_id) { rf_id_undefined, -1 };
          }
@@ -397,6 +686,21 @@ found:      rf_free_evar(vm, vm->u[id].prev, n);
    return (struct rf_id) { rf_id_undefined, 0 };
 }
 
+/**
+ * Корректирует значения (ссылки на ячейки) после упорядочивания памяти
+ * РЕФАЛ-машины `refal_vm_compact()`.
+ */
+static inline
+void rtrie_relocate(
+      struct refal_trie *rt,
+      const rf_index    *map,    ///< таблица соответствия индексов.
+      rf_index          size)    ///< размер таблицы.
+{
+   assert(rt);
+   for (rtrie_index i = 0; i != rt->free; ++i)
+      rt->n[i].val = rf_relocate_id(map, size, rt->n[i].val);
+}
+
 
 /**\}*/
 /**\}*/
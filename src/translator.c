@@ -446,7 +446,9 @@ void lexem_number(struct lexer *lex, struct refal_vm *vm, struct refal_message *
          break;
       ++lex->pos;
    }
-   rf_alloc_int(vm, number);
+   if (!rf_alloc_int(vm, number)) {
+      syntax_error(st, "макроцифру невозможно разместить", lex->line_num, lex->pos, &lex->buf.s[lex->line], &lex->buf.s[lex->buf.free]);
+   }
 }
 
 ///\page    Синтаксис
@@ -753,7 +755,7 @@ importlist: while (L_semicolon != (lexeme = lexer_next_lexem(&lex, st))) {
             switch (lexeme) {
             case L_semicolon:
                cmd_sentence = rf_alloc_command(vm, rf_sentence);
-               vm->u[cmd_sentence].data = vm->free;
+               RF_VALUE(vm, cmd_sentence).data = vm->free;
                continue;
             case L_equal:
                rf_alloc_command(vm, rf_equal);
@@ -849,7 +851,7 @@ incomplete:       lex.line = lex.id_line;
                      continue;
                   }
                   // Функция закончена, следом должен быть rf_name.
-                  vm->u[cmd_sentence].data = vm->free;
+                  RF_VALUE(vm, cmd_sentence).data = vm->free;
                   goto sentence_complete;
 
                ///\subsection Вычисление     Вычислительные скобки
@@ -895,13 +897,13 @@ executor_in_pattern: error = "вычислительные скобки в об
                   // Копируем адрес функции из парной открывающей, для вызова исполнителем.
                   // Если функция не определена, но между скобок содержатся
                   // идентификаторы (.value == 1) задаём открывающей скобке ссылку на эту.
-                  rf_index ec = rf_alloc_value(vm, vm->u[cmd_exec[ep]].data, rf_execute);
-                  if (vm->u[cmd_exec[ep]].id.tag == rf_id_undefined) {
-                     if (!vm->u[cmd_exec[ep]].id.link) {
+                  rf_index ec = rf_alloc_value(vm, RF_VALUE(vm, cmd_exec[ep]).data, rf_execute);
+                  if (RF_VALUE(vm, cmd_exec[ep]).id.tag == rf_id_undefined) {
+                     if (!RF_VALUE(vm, cmd_exec[ep]).id.link) {
                         error = "активное выражение должно содержать имя вычислимой функции";
                         goto cleanup;
                      }
-                     vm->u[cmd_exec[ep]].data = ec;
+                     RF_VALUE(vm, cmd_exec[ep]).data = ec;
                   }
                   cmd_exec[ep--] = 0;
                   continue;
@@ -964,11 +966,11 @@ sentence_complete:
                   // сохраняем в маркере текущего предложения
                   // ссылку на данные следующего и добавляем новый маркер.
                   if (cmd_sentence)
-                     vm->u[cmd_sentence].data = vm->free;
+                     RF_VALUE(vm, cmd_sentence).data = vm->free;
                   if (function_block) {
                      assert(cmd_sentence);
                      rf_alloc_command(vm, rf_sentence);
-                     cmd_sentence = vm->u[cmd_sentence].data;
+                     cmd_sentence = RF_VALUE(vm, cmd_sentence).data;
                      local = 0;
                      ++idc;
                   } else {
@@ -1080,14 +1082,14 @@ sentence_complete:
                      // Если открыта вычислительная скобка, задаём ей адрес
                      // первой вычислимой функции из выражения.
                      case rf_id_op_code: case rf_id_mach_code:
-                        if (cmd_exec[ep] && vm->u[cmd_exec[ep]].id.tag == rf_id_undefined) {
+                        if (cmd_exec[ep] && RF_VALUE(vm, cmd_exec[ep]).id.tag == rf_id_undefined) {
                            // Если в поле действия данной скобки встретился идентификатор,
                            // который на данный момент не определён, не известно,
                            // вычислим ли он. Возможно, именно определённая для него
                            // функция и должна быть вызвана скобкой. В таком случае
                            // откладываем решение до этапа, когда разрешаются
                            // неопределённые на данном проходе идентификаторы.
-                           if (vm->u[cmd_exec[ep]].id.link)
+                           if (RF_VALUE(vm, cmd_exec[ep]).id.link)
                               goto implicit_declaration;
                            rf_assign_id(vm, cmd_exec[ep], ids->n[lex.node].val);
                            imports = 0;
@@ -1109,13 +1111,13 @@ no_identifier_in_module:   error = "идентификатор не опреде
                         if (!undefined_fist)
                            undefined_fist = l;
                         if (undefined_last)
-                           vm->u[undefined_last].link = l;
+                           RF_VALUE(vm, undefined_last).link = l;
                         undefined_last = l;
                         // Если открыта скобка и функция ей не присвоена, добавим
                         // rf_execute, а скобке зададим фиктивное значение, что бы при
                         // проверке в закрывающей скобке отличить неопределённые
                         // идентификаторы от отсутствия таковых.
-                        if (cmd_exec[ep] && vm->u[cmd_exec[ep]].id.tag == rf_id_undefined) {
+                        if (cmd_exec[ep] && RF_VALUE(vm, cmd_exec[ep]).id.tag == rf_id_undefined) {
                            rf_alloc_value(vm, cmd_exec[ep], rf_open_function);
                            rf_assign_id(vm, cmd_exec[ep], (struct rf_id) { rf_id_undefined, 1 });
                         }
@@ -1146,20 +1148,20 @@ no_identifier_in_module:   error = "идентификатор не опреде
          assert(vm->u[undef].op == rf_undefined);
          const rf_index opcode = vm->u[undef].prev;
          rf_index s = vm->u[undef].next;
-         undef = vm->u[undef].link;
+         undef = RF_VALUE(vm, undef).link;
 
          rf_index exec_open = 0;
          if (vm->u[s].op == rf_open_function) {
-            exec_open = vm->u[s].link;
+            exec_open = RF_VALUE(vm, s).link;
             s = vm->u[s].next;
          } else if (ex) {
             continue;
          }
-         lex.line_num = vm->u[s].num;
+         lex.line_num = RF_VALUE(vm, s).data;
          s = vm->u[s].next;
-         lex.pos  = vm->u[s].num;
+         lex.pos  = RF_VALUE(vm, s).data;
          s = vm->u[s].next;
-         lex.line = vm->u[s].num;
+         lex.line = RF_VALUE(vm, s).data;
          s = vm->u[s].next;
 
          // В результате трансляции rf_name в данной позиции невозможен,
@@ -1169,7 +1171,7 @@ no_identifier_in_module:   error = "идентификатор не опреде
             rf_free_evar(vm, vm->u[opcode].prev, s);
             continue;
          }
-         rtrie_index n = vm->u[opcode].link;
+         rtrie_index n = RF_VALUE(vm, opcode).link;
          if (ids->n[n].val.tag == rf_id_undefined) {
             // TODO опциональное поведение?
             if (ex)
@@ -1183,8 +1185,8 @@ no_identifier_in_module:   error = "идентификатор не опреде
          // Скобке присваивается первая вычислимая функция, так что порядок
          // обработки списка неопределённых идентификаторов важен.
          if (exec_open) {
-            rf_index exec_close = vm->u[exec_open].link;
-            if (vm->u[exec_close].id.tag == rf_id_undefined) {
+            rf_index exec_close = RF_VALUE(vm, exec_open).link;
+            if (RF_VALUE(vm, exec_close).id.tag == rf_id_undefined) {
                if (ids->n[n].val.tag == rf_id_op_code || ids->n[n].val.tag == rf_id_mach_code) {
                   assert(ex);
                   rf_assign_id(vm, exec_close, ids->n[n].val);
@@ -1217,3 +1219,334 @@ cleanup:
    //TODO количество ошибок не подсчитывается.
    return error ? 1 : 0;
 }
+
+/**
+ * Определяет операцию арифметической функции, вызываемой скобкой `i`
+ * с двумя операндами — s-переменными либо числами (см. `rf_arith`).
+ */
+static
+rf_arith arith_call(
+      const struct refal_vm   *vm,
+      rf_index                i)
+{
+   rf_index s = vm->u[i].next;
+   for (int n = 0; n != 2; ++n, s = vm->u[s].next) {
+      if (vm->u[s].op != rf_svar && vm->u[s].op != rf_number)
+         return rf_arith_none;
+   }
+   if (vm->u[s].op != rf_execute)
+      return rf_arith_none;
+   const struct rf_id id = RF_VALUE(vm, s).id;
+   if (id.tag != rf_id_mach_code || !id.link || !(id.link < vm->library_size))
+      return rf_arith_none;
+   return rf_arith_function(vm->library[id.link].function);
+}
+
+/**
+ * Отмечает копии e-переменных в аргументе вызова функции, лишь читающей его
+ * (см. `rf_reader_function()`), как заимствуемые на время вызова.
+ * Аргумент не должен содержать вложенных вызовов и переносимых переменных:
+ * исходные значения заимствованных до вызова остаются на месте. Переменная,
+ * входящая в аргумент повторно, копируется.
+ */
+static
+void borrow_call(
+      struct refal_vm   *vm,
+      rf_index          i)
+{
+   rf_index e = vm->u[i].next;
+   for (; vm->u[e].op != rf_execute; e = vm->u[e].next) {
+      const rf_opcode op = vm->u[e].op;
+      if (op == rf_open_function)
+         return;
+      if ((op == rf_tvar || op == rf_evar) && !(vm->u[e].mode & rf_op_var_copy))
+         return;
+   }
+   const struct rf_id id = RF_VALUE(vm, e).id;
+   if (id.tag != rf_id_mach_code || !id.link || !(id.link < vm->library_size)
+    || !rf_reader_function(vm->library[id.link].function))
+      return;
+   for (rf_index s = vm->u[i].next; s != e; s = vm->u[s].next) {
+      if (vm->u[s].op != rf_evar)
+         continue;
+      unsigned n = 0;
+      for (rf_index k = vm->u[i].next; k != e; k = vm->u[k].next)
+         n += vm->u[k].op == rf_evar && RF_VALUE(vm, k).link == RF_VALUE(vm, s).link;
+      if (n == 1) {
+         vm->u[s].mode |= rf_op_var_borrow;
+         vm->u[e].mode |= rf_op_exec_borrow;
+      }
+   }
+}
+
+/**
+ * Отмечает в режиме опкода пары команд, исполняемые без повторного выбора
+ * обработчика. Выбраны наиболее частые в примерах пары (подсчитываются при
+ * сборке с `REFAL_INTERPRETER_PROFILE`): s-переменная либо литерал, за
+ * которыми следует литерал, пустой образец и вызов в начале результата.
+ * Так же отмечаются вызовы арифметических функций (`arith_call()`) и
+ * заимствуемые вызовами значения переменных (`borrow_call()`).
+ */
+static
+void fuse_opcodes(
+      struct refal_vm   *vm,
+      rf_index          code)
+{
+   for (rf_index i = 1; i != code; i = vm->u[i].next) {
+      const rf_opcode op = vm->u[vm->u[i].next].op;
+      switch (vm->u[i].op) {
+      case rf_sentence:
+         if (op == rf_equal)
+            vm->u[i].mode |= rf_op_sentence_empty;
+         break;
+      case rf_equal:
+         if (op == rf_open_function)
+            vm->u[i].mode |= rf_op_call_next;
+         break;
+      case rf_open_function:
+         vm->u[i].mode |= arith_call(vm, i);
+         borrow_call(vm, i);
+         break;
+      case rf_char: case rf_number: case rf_svar:
+         if (op == rf_char || op == rf_number)
+            vm->u[i].mode |= rf_op_literal_next;
+         break;
+      default:
+         break;
+      }
+   }
+}
+
+/**
+ * Определяет режим e-переменной образца: наименьшее количество термов,
+ * требуемых остатком образца до конца уровня скобок (не более
+ * `rf_op_evar_tail`), и отсутствие среди них e-переменных и ящиков.
+ * Размер такой переменной определяется отсчётом термов от правой границы,
+ * иначе она расширяется лишь до этой позиции.
+ */
+static
+rf_op_mode evar_tail(
+      const struct refal_vm   *vm,
+      rf_index                e)
+{
+   unsigned terms = 0;
+   unsigned depth = 0;
+   bool rigid = true;
+   for (rf_index i = vm->u[e].next; ; i = vm->u[i].next) {
+      switch (vm->u[i].op) {
+      case rf_opening_bracket:
+         if (!depth++)
+            ++terms;
+         continue;
+      case rf_closing_bracket:
+         if (!depth)
+            break;
+         --depth;
+         continue;
+      case rf_identifier:
+         if (!depth && RF_VALUE(vm, i).id.tag == rf_id_box)
+            rigid = false;
+         else if (!depth)
+            ++terms;
+         continue;
+      case rf_char: case rf_number: case rf_svar: case rf_tvar:
+         if (!depth)
+            ++terms;
+         continue;
+      case rf_evar:
+         if (!depth)
+            rigid = false;
+         continue;
+      default:
+         break;
+      }
+      break;
+   }
+   if (terms > rf_op_evar_tail)
+      return rf_op_evar_tail;
+   return rigid ? rf_op_evar_rigid | terms : terms;
+}
+
+/**
+ * Отмечает режим e-переменных в образцах (см. `evar_tail()`).
+ */
+static
+void mark_evar_tails(
+      struct refal_vm   *vm,
+      rf_index          code)
+{
+   bool pattern = false;
+   for (rf_index i = 1; i != code; i = vm->u[i].next) {
+      switch (vm->u[i].op) {
+      // Образец следует за заголовком однострочной функции, началом
+      // предложения и условием.
+      case rf_name: case rf_sentence: case rf_colon:
+         pattern = true;
+         break;
+      case rf_equal:
+         pattern = false;
+         break;
+      case rf_evar:
+         if (pattern)
+            vm->u[i].mode = evar_tail(vm, i);
+         break;
+      default:
+         break;
+      }
+   }
+}
+
+/**
+ * Проверяет, начинается ли образец предложения литералом (ящик в образце
+ * сопоставляется по содержимому, потому не подходит).
+ */
+static inline
+bool sentence_literal(
+      const struct refal_vm   *vm,
+      rf_index                s)
+{
+   const rf_index p = vm->u[s].next;
+   switch (vm->u[p].op) {
+   case rf_char: case rf_number:
+      return true;
+   case rf_identifier:
+      return RF_VALUE(vm, p).id.tag != rf_id_box;
+   default:
+      return false;
+   }
+}
+
+/**
+ * Строит таблицу выбора предложения по первому элементу поля зрения для серий
+ * предложений, образцы которых начинаются литералом (таблицы ключевых слов,
+ * классификаторы). Ссылки предложений серии связывают образцы с одинаковым
+ * литералом, порядок сопоставления при этом сохраняется.
+ */
+static
+void index_sentences(
+      struct refal_vm   *vm,
+      rf_index          code)
+{
+   rf_index entries = 0;
+   rf_index longest = 0;
+   rf_index size = 8;
+   rf_index *run = NULL;
+   // При первом проходе подсчитываем предложения в сериях, при втором строим.
+   for (int build = 0; build != 2; ++build) {
+      for (rf_index f = 1; f != code; f = vm->u[f].next) {
+         if (vm->u[f].op != rf_name)
+            continue;
+         for (rf_index s = vm->u[f].next; vm->u[s].op == rf_sentence; ) {
+            rf_index n = 0;
+            rf_index end = s;
+            for (; vm->u[end].op == rf_sentence && sentence_literal(vm, end); ++n) {
+               if (build)
+                  run[n] = end;
+               end = RF_VALUE(vm, end).link;
+            }
+            if (n >= REFAL_TRANSLATOR_DISPATCH_SENTENCES) {
+               if (!build) {
+                  entries += n + 1;
+                  longest = n > longest ? n : longest;
+               } else {
+                  *rf_dispatch_slot(vm, s, rf_undefined, 0) = (struct rf_dispatch) {
+                     .run = s, .sentence = end, .op = rf_undefined };
+                  while (n--) {
+                     const rf_index p = vm->u[run[n]].next;
+                     struct rf_dispatch *d = rf_dispatch_slot(vm, s, vm->u[p].op, RF_VALUE(vm, p).data);
+                     RF_VALUE(vm, run[n]).link = d->run ? d->sentence : end;
+                     *d = (struct rf_dispatch) {
+                        .run = s, .sentence = run[n], .data = RF_VALUE(vm, p).data, .op = vm->u[p].op };
+                  }
+                  vm->u[s].mode |= rf_op_sentence_index;
+               }
+            }
+            s = end != s ? end : RF_VALUE(vm, s).link;
+         }
+      }
+      if (build || !entries)
+         break;
+      while (size < 2 * entries)
+         size *= 2;
+      vm->dispatch = refal_malloc(size * sizeof(*vm->dispatch));
+      run = refal_malloc(longest * sizeof(*run));
+      if (!vm->dispatch || !run)
+         break;
+      memset(vm->dispatch, 0, size * sizeof(*vm->dispatch));
+      vm->dispatch_size = size;
+   }
+   if (run)
+      refal_free(run, longest * sizeof(*run));
+   if (vm->dispatch && !vm->dispatch_size) {
+      refal_free(vm->dispatch, size * sizeof(*vm->dispatch));
+      vm->dispatch = NULL;
+   }
+}
+
+rf_index refal_translate_layout(
+      struct refal_vm      *vm,
+      struct refal_trie    *ids)
+{
+   // Последняя функция завершена пустышкой.
+   const rf_index end = vm->u[vm->free].prev;
+   if (vm->u[end].op != rf_name)
+      return 0;
+
+   // Переносим ящики (функции без rf_equal) в конец программы.
+   // Каждая функция завершается заголовком следующей, так что порядок
+   // функций безразличен. Исключение — функции без предложений: ссылка
+   // на них указывает на следующий заголовок, с которым они и переносятся.
+   // Перенесённые ящики следуют за последней функцией, так что просмотр
+   // завершается на первом из них либо на завершающем заголовке.
+   rf_index data = end;
+   for (rf_index s = 1; s != data && s != end; ) {
+      assert(vm->u[s].op == rf_name);
+      bool exec = false;
+      rf_index i = s;
+      do {
+         exec = exec || vm->u[i].op == rf_equal;
+         i = vm->u[i].next;
+      } while (i != end && (vm->u[i].op != rf_name || vm->u[vm->u[i].prev].op == rf_name));
+      if (!exec) {
+         rf_index first = s;
+         if (s == 1) {
+            // Начало списка неподвижно: ящик получает новый заголовок,
+            // а прежний остаётся пустой функцией перед исполняемым кодом.
+            first = rf_alloc_value(vm, RF_VALUE(vm, s).data, rf_name);
+            rf_splice_evar_prev(vm, s, i, vm->free);
+            rf_splice_evar_prev(vm, end, vm->free, end);
+         } else if (i != end) {
+            rf_splice_evar_prev(vm, vm->u[s].prev, i, end);
+         }
+         if (data == end)
+            data = first;
+      }
+      s = i;
+   }
+   rf_index code = vm->u[data].prev;
+
+   // Предложения, завершающие функцию, ссылаются на следующий за ней заголовок.
+   for (rf_index i = end, name = end; i; i = vm->u[i].prev) {
+      if (vm->u[i].op == rf_name)
+         name = i;
+      else if (vm->u[i].op == rf_sentence && vm->u[RF_VALUE(vm, i).link].op == rf_name)
+         RF_VALUE(vm, i).link = name;
+   }
+
+   // Размещаем ячейки последовательно, исключая освобождённые транслятором.
+   const rf_index size = vm->size;
+   rf_index *map = refal_vm_compact(vm);
+   if (!map)
+      return 0;
+   rtrie_relocate(ids, map, size);
+   if (code) {
+      vm->code = map[code];
+      fuse_opcodes(vm, vm->code);
+      mark_evar_tails(vm, vm->code);
+      if (REFAL_TRANSLATOR_DISPATCH_SENTENCES)
+         index_sentences(vm, vm->code);
+      refal_vm_protect_code(vm);
+   }
+   refal_free(map, size * sizeof(*map));
+   return vm->code;
+}
@@ -29,6 +29,12 @@
 #define REFAL_TRANSLATOR_BRACKETS_DEFAULT 128
 #endif
 
+/// Наименьшая длина серии предложений, начинающихся литералом, для которой
+/// предложение выбирается по таблице (`rf_dispatch_slot()`). 0 — не выбирать.
+#ifndef REFAL_TRANSLATOR_DISPATCH_SENTENCES
+#define REFAL_TRANSLATOR_DISPATCH_SENTENCES 4
+#endif
+
 #ifndef REFAL_INITIAL_FILEBUFFER
 #define REFAL_INITIAL_FILEBUFFER 1024 //TODO увеличить. В 4-х байтных символах.
 #endif
@@ -105,4 +111,21 @@ int refal_translate_istream_to_bytecode(
       struct refal_message *st
       );
 
+/**
+ * Размещает оттранслированную программу для исполнения.
+ *
+ * Исполняемые функции располагаются подряд от начала массива ячеек в порядке
+ * определения, за ними — ящики, изменяемые при исполнении. Ячейки, временно
+ * использованные и освобождённые транслятором, исключаются, так что опкоды
+ * каждого предложения занимают смежные ячейки. Ссылки в таблице символов
+ * корректируются. Исполняемый код защищается от записи (`refal_protect()`).
+ *
+ * Вызывается после успешной трансляции, до размещения данных в поле зрения.
+ * \result последняя ячейка исполняемого кода (`vm->code`) либо 0.
+ */
+rf_index refal_translate_layout(
+      struct refal_vm      *vm,     ///< Память с программой.
+      struct refal_trie    *ids     ///< Таблица символов.
+      );
+
 /**\}*/